@@ -0,0 +1,673 @@
+#include "BVH.h"
+#include "../Core/MemoryPool.h"
+#include "../Core/Ray.h"
+#include "../Core/Intersection.h"
+#include "../Core/Parallel.h"
+#include "../Core/CacheSimulator.h"
+
+namespace Hebex
+{
+	struct BVHPrimitiveInfo {
+		BVHPrimitiveInfo() {}
+		BVHPrimitiveInfo(int primitiveNumber, const BBox &bounds) :
+			primitiveNumber(primitiveNumber), bounds(bounds),
+			centroid(.5f * bounds.pMin + .5f * bounds.pMax) {
+		}
+
+		int primitiveNumber;
+		BBox bounds;
+		Point3f centroid;
+	};
+
+	struct BVHBuildNode {
+		void InitLeaf(int first, int n, const BBox &b) {
+			firstPrimOffset = first;
+			nPrimitives = n;
+			bounds = b;
+			children[0] = children[1] = nullptr;
+		}
+
+		void InitInterior(int axis, BVHBuildNode *c0, BVHBuildNode *c1) {
+			children[0] = c0;
+			children[1] = c1;
+			bounds = Union(c0->bounds, c1->bounds);
+			splitAxis = axis;
+			nPrimitives = 0;
+		}
+
+		BBox bounds;
+		BVHBuildNode *children[2];
+		int splitAxis, firstPrimOffset, nPrimitives;
+	};
+
+	struct MortonPrimitive {
+		int primitiveIndex;
+		uint64_t mortonCode;
+	};
+
+	struct LBVHTreelet {
+		int startIndex, nPrimitives;
+		BVHBuildNode *buildNodes;
+	};
+
+	// Number of centroid buckets evaluated per split by the binned SAH
+	static const int nBuckets = 12;
+
+	// Leading Morton bits that group primitives into one HLBVH treelet
+	static const int nTreeletBits = 12;
+
+	// v is the centroid offset inside the centroid bounds, in [0, 1]^3
+	inline uint64_t EncodeMorton3(const Vec3f &v, int bitsPerAxis) {
+		float scale = float(uint64_t(1) << bitsPerAxis);
+		uint64_t maxCoord = (uint64_t(1) << bitsPerAxis) - 1;
+		uint64_t x = std::min(uint64_t(std::max(0.f, v.x * scale)), maxCoord);
+		uint64_t y = std::min(uint64_t(std::max(0.f, v.y * scale)), maxCoord);
+		uint64_t z = std::min(uint64_t(std::max(0.f, v.z * scale)), maxCoord);
+		return (LeftShift3(x) << 2) | (LeftShift3(y) << 1) | LeftShift3(z);
+	}
+
+	// Parallel LSD radix sort, 8 bits per pass. Every chunk of the input
+	// histograms and scatters its own range, which keeps each pass stable.
+	static void RadixSort(std::vector<MortonPrimitive> *v, int nBits) {
+		const int bitsPerPass = 8;
+		const int nPassBuckets = 1 << bitsPerPass;
+		const int bitMask = nPassBuckets - 1;
+		const int nPasses = (nBits + bitsPerPass - 1) / bitsPerPass;
+		const int64_t nItems = v->size();
+		const int64_t minChunkSize = 16384;
+		const int nChunks = (int)std::max<int64_t>(1, std::min<int64_t>(4 * MaxThreadIndex(),
+			(nItems + minChunkSize - 1) / minChunkSize));
+		const int64_t chunkSize = (nItems + nChunks - 1) / nChunks;
+
+		std::vector<MortonPrimitive> tempVector(v->size());
+		std::vector<int64_t> bucketOffsets(nChunks * nPassBuckets);
+		for (int pass = 0; pass < nPasses; ++pass) {
+			int lowBit = pass * bitsPerPass;
+			std::vector<MortonPrimitive> &in = (pass & 1) ? tempVector : *v;
+			std::vector<MortonPrimitive> &out = (pass & 1) ? *v : tempVector;
+
+			ParallelFor([&](int64_t chunk) {
+				int64_t *counts = &bucketOffsets[chunk * nPassBuckets];
+				std::fill(counts, counts + nPassBuckets, 0);
+				int64_t end = std::min(nItems, (chunk + 1) * chunkSize);
+				for (int64_t i = chunk * chunkSize; i < end; ++i)
+					counts[(in[i].mortonCode >> lowBit) & bitMask]++;
+			}, nChunks);
+
+			// Turn the per-chunk counts into output offsets, bucket-major
+			int64_t offset = 0;
+			for (int bucket = 0; bucket < nPassBuckets; ++bucket) {
+				for (int chunk = 0; chunk < nChunks; ++chunk) {
+					int64_t count = bucketOffsets[chunk * nPassBuckets + bucket];
+					bucketOffsets[chunk * nPassBuckets + bucket] = offset;
+					offset += count;
+				}
+			}
+
+			ParallelFor([&](int64_t chunk) {
+				int64_t *offsets = &bucketOffsets[chunk * nPassBuckets];
+				int64_t end = std::min(nItems, (chunk + 1) * chunkSize);
+				for (int64_t i = chunk * chunkSize; i < end; ++i)
+					out[offsets[(in[i].mortonCode >> lowBit) & bitMask]++] = in[i];
+			}, nChunks);
+		}
+		if (nPasses & 1) std::swap(*v, tempVector);
+	}
+
+	BVHAccel::BVHAccel(const std::vector<std::shared_ptr<Primitive> > &p, int maxPrimsInNode,
+		SplitMethod splitMethod, int mortonBits) :
+		mMaxPrimsInNode(std::min(255, maxPrimsInNode)), mSplitMethod(splitMethod),
+		mMortonBits(mortonBits > 30 ? 63 : 30), mPrimitives(p) {
+		Build();
+	}
+
+	BVHAccel::~BVHAccel() {
+		FreeAligned(mNodes);
+	}
+
+	void BVHAccel::Build() {
+		FreeAligned(mNodes);
+		mNodes = nullptr;
+		mTotalNodes = 0;
+		mMaxDepth = 0;
+		mRefitTasks.clear();
+		mRefitTopNodes.clear();
+		mPrimitiveRefs.clear();
+		// Leaf entries in input order; the builders reorder them
+		for (const auto &prim : mPrimitives)
+			PrimitiveRef::Append(prim.get(), &mPrimitiveRefs);
+		if (mPrimitiveRefs.empty()) return;
+
+		std::vector<BVHPrimitiveInfo> primitiveInfo(mPrimitiveRefs.size());
+		ParallelFor([&](int64_t i) {
+			primitiveInfo[i] = BVHPrimitiveInfo(i, mPrimitiveRefs[i].WorldBound());
+		}, mPrimitiveRefs.size(), 4096);
+
+		MemoryPool pool(1024 * 1024);
+		int totalNodes = 0;
+		std::vector<PrimitiveRef> orderedPrims;
+		BVHBuildNode *root;
+		if (mSplitMethod == SplitMethod::SAH) {
+			orderedPrims.reserve(mPrimitiveRefs.size());
+			root = RecursiveBuild(pool, primitiveInfo, 0, mPrimitiveRefs.size(), &totalNodes, orderedPrims);
+		}
+		else {
+			orderedPrims.resize(mPrimitiveRefs.size());
+			root = HLBVHBuild(pool, primitiveInfo, &totalNodes, orderedPrims);
+		}
+		mPrimitiveRefs.swap(orderedPrims);
+
+		mNodes = AllocAligned<LinearBVHNode>(totalNodes);
+		FirstTouch(mNodes, totalNodes * sizeof(LinearBVHNode));
+		mTotalNodes = totalNodes;
+		int offset = 0;
+		FlattenBVHTree(root, 0, &offset);
+		HEBEX_ASSERT(offset == totalNodes);
+		mBuildSAHCost = SAHCost();
+	}
+
+	BBox BVHAccel::WorldBound() const {
+		return mNodes ? mNodes[0].bounds : BBox();
+	}
+
+	BVHBuildNode *BVHAccel::RecursiveBuild(MemoryPool &pool, std::vector<BVHPrimitiveInfo> &primitiveInfo,
+		int start, int end, int *totalNodes, std::vector<PrimitiveRef> &orderedPrims) {
+		HEBEX_ASSERT(start != end);
+		BVHBuildNode *node = pool.Alloc<BVHBuildNode>();
+		(*totalNodes)++;
+
+		BBox bounds;
+		for (int i = start; i < end; ++i)
+			bounds = Union(bounds, primitiveInfo[i].bounds);
+
+		int nPrimitives = end - start;
+		auto createLeaf = [&]() {
+			int firstPrimOffset = orderedPrims.size();
+			for (int i = start; i < end; ++i)
+				orderedPrims.push_back(mPrimitiveRefs[primitiveInfo[i].primitiveNumber]);
+			node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+			return node;
+		};
+
+		if (nPrimitives == 1) return createLeaf();
+
+		// Choose split dimension from the extent of the primitive centroids
+		BBox centroidBounds;
+		for (int i = start; i < end; ++i)
+			centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+		int dim = centroidBounds.MaximumExtent();
+
+		int mid = (start + end) / 2;
+		if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
+			// All centroids coincide: SAH cannot separate them, so only split
+			// by count to keep leaves within mMaxPrimsInNode
+			if (nPrimitives <= mMaxPrimsInNode) return createLeaf();
+		}
+		else if (nPrimitives <= 2) {
+			std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end - 1] + 1,
+				[dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
+				return a.centroid[dim] < b.centroid[dim];
+			});
+		}
+		else {
+			// Bin primitive centroids along dim
+			struct BucketInfo {
+				int count = 0;
+				BBox bounds;
+			};
+			BucketInfo buckets[nBuckets];
+			float invExtent = 1.f / (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]);
+			for (int i = start; i < end; ++i) {
+				int b = nBuckets * ((primitiveInfo[i].centroid[dim] - centroidBounds.pMin[dim]) * invExtent);
+				if (b == nBuckets) b = nBuckets - 1;
+				buckets[b].count++;
+				buckets[b].bounds = Union(buckets[b].bounds, primitiveInfo[i].bounds);
+			}
+
+			// SAH cost of splitting after each bucket, sweeping from both sides
+			float cost[nBuckets - 1];
+			int countBelow = 0;
+			BBox below;
+			for (int i = 0; i < nBuckets - 1; ++i) {
+				below = Union(below, buckets[i].bounds);
+				countBelow += buckets[i].count;
+				cost[i] = countBelow * below.SurfaceArea();
+			}
+			int countAbove = 0;
+			BBox above;
+			for (int i = nBuckets - 1; i >= 1; --i) {
+				above = Union(above, buckets[i].bounds);
+				countAbove += buckets[i].count;
+				cost[i - 1] += countAbove * above.SurfaceArea();
+			}
+
+			int minCostSplitBucket = 0;
+			float minCost = cost[0];
+			for (int i = 1; i < nBuckets - 1; ++i) {
+				if (cost[i] < minCost) {
+					minCost = cost[i];
+					minCostSplitBucket = i;
+				}
+			}
+
+			// Relative cost: one traversal step against intersecting every primitive
+			float leafCost = nPrimitives;
+			minCost = .125f + minCost / bounds.SurfaceArea();
+
+			if (nPrimitives > mMaxPrimsInNode || minCost < leafCost) {
+				BVHPrimitiveInfo *pmid = std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+					[=](const BVHPrimitiveInfo &pi) {
+					int b = nBuckets * ((pi.centroid[dim] - centroidBounds.pMin[dim]) * invExtent);
+					if (b == nBuckets) b = nBuckets - 1;
+					return b <= minCostSplitBucket;
+				});
+				mid = pmid - &primitiveInfo[0];
+			}
+			else {
+				return createLeaf();
+			}
+		}
+
+		node->InitInterior(dim,
+			RecursiveBuild(pool, primitiveInfo, start, mid, totalNodes, orderedPrims),
+			RecursiveBuild(pool, primitiveInfo, mid, end, totalNodes, orderedPrims));
+		return node;
+	}
+
+	BVHBuildNode *BVHAccel::HLBVHBuild(MemoryPool &pool, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+		int *totalNodes, std::vector<PrimitiveRef> &orderedPrims) const {
+		const int64_t nPrimitives = primitiveInfo.size();
+		const int64_t chunkSize = 16384;
+		const int64_t nChunks = (nPrimitives + chunkSize - 1) / chunkSize;
+
+		// Reduce the centroid bounds per chunk, then serially over the chunks
+		std::vector<BBox> chunkBounds(nChunks);
+		ParallelFor([&](int64_t chunk) {
+			int64_t end = std::min(nPrimitives, (chunk + 1) * chunkSize);
+			for (int64_t i = chunk * chunkSize; i < end; ++i)
+				chunkBounds[chunk] = Union(chunkBounds[chunk], primitiveInfo[i].centroid);
+		}, nChunks);
+		BBox bounds;
+		for (const BBox &b : chunkBounds) bounds = Union(bounds, b);
+
+		const int bitsPerAxis = mMortonBits / 3;
+		std::vector<MortonPrimitive> mortonPrims(nPrimitives);
+		ParallelFor([&](int64_t i) {
+			mortonPrims[i].primitiveIndex = primitiveInfo[i].primitiveNumber;
+			Vec3f centroidOffset = bounds.Offset(primitiveInfo[i].centroid);
+			// Flat centroid bounds give inf/NaN offsets on that axis
+			for (int axis = 0; axis < 3; ++axis)
+				if (!(bounds.pMax[axis] > bounds.pMin[axis])) centroidOffset[axis] = 0.f;
+			mortonPrims[i].mortonCode = EncodeMorton3(centroidOffset, bitsPerAxis);
+		}, nPrimitives, 4096);
+
+		RadixSort(&mortonPrims, mMortonBits);
+
+		// Primitives sharing the leading code bits form one treelet
+		std::vector<LBVHTreelet> treeletsToBuild;
+		const int treeletShift = mMortonBits - nTreeletBits;
+		const uint64_t mask = ((uint64_t(1) << nTreeletBits) - 1) << treeletShift;
+		for (int64_t start = 0, end = 1; end <= nPrimitives; ++end) {
+			if (end == nPrimitives ||
+				((mortonPrims[start].mortonCode & mask) != (mortonPrims[end].mortonCode & mask))) {
+				int n = end - start;
+				// A binary tree over n primitives has at most 2n - 1 nodes
+				int maxBVHNodes = 2 * n - 1;
+				BVHBuildNode *nodes = pool.Alloc<BVHBuildNode>(maxBVHNodes, false);
+				treeletsToBuild.push_back({ (int)start, n, nodes });
+				start = end;
+			}
+		}
+
+		std::atomic<int> atomicTotal(0), orderedPrimsOffset(0);
+		ParallelFor([&](int64_t i) {
+			int nodesCreated = 0;
+			LBVHTreelet &tr = treeletsToBuild[i];
+			tr.buildNodes = EmitLBVH(tr.buildNodes, primitiveInfo, &mortonPrims[tr.startIndex], tr.nPrimitives,
+				&nodesCreated, orderedPrims, &orderedPrimsOffset, treeletShift - 1);
+			atomicTotal += nodesCreated;
+		}, treeletsToBuild.size());
+		*totalNodes = atomicTotal;
+
+		std::vector<BVHBuildNode *> finishedTreelets;
+		std::vector<uint64_t> treeletCodes;
+		finishedTreelets.reserve(treeletsToBuild.size());
+		treeletCodes.reserve(treeletsToBuild.size());
+		for (const LBVHTreelet &treelet : treeletsToBuild) {
+			finishedTreelets.push_back(treelet.buildNodes);
+			treeletCodes.push_back(mortonPrims[treelet.startIndex].mortonCode);
+		}
+
+		if (mSplitMethod == SplitMethod::HLBVH)
+			return BuildUpperSAH(pool, finishedTreelets, 0, finishedTreelets.size(), totalNodes);
+		return BuildUpperLBVH(pool, finishedTreelets, treeletCodes, 0, finishedTreelets.size(),
+			mMortonBits - 1, totalNodes);
+	}
+
+	BVHBuildNode *BVHAccel::EmitLBVH(BVHBuildNode *&buildNodes, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+		MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
+		std::vector<PrimitiveRef> &orderedPrims, std::atomic<int> *orderedPrimsOffset, int bitIndex) const {
+		if (nPrimitives <= mMaxPrimsInNode) {
+			(*totalNodes)++;
+			BVHBuildNode *node = buildNodes++;
+			BBox bounds;
+			int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
+			for (int i = 0; i < nPrimitives; ++i) {
+				int primitiveIndex = mortonPrims[i].primitiveIndex;
+				orderedPrims[firstPrimOffset + i] = mPrimitiveRefs[primitiveIndex];
+				bounds = Union(bounds, primitiveInfo[primitiveIndex].bounds);
+			}
+			node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+			return node;
+		}
+
+		int splitOffset;
+		if (bitIndex < 0) {
+			// Identical codes left: split by count to keep leaves small
+			splitOffset = nPrimitives / 2;
+		}
+		else {
+			uint64_t mask = uint64_t(1) << bitIndex;
+			if ((mortonPrims[0].mortonCode & mask) == (mortonPrims[nPrimitives - 1].mortonCode & mask))
+				return EmitLBVH(buildNodes, primitiveInfo, mortonPrims, nPrimitives, totalNodes,
+					orderedPrims, orderedPrimsOffset, bitIndex - 1);
+
+			// Binary search for the first primitive with this bit set
+			int searchStart = 0, searchEnd = nPrimitives - 1;
+			while (searchStart + 1 != searchEnd) {
+				int mid = (searchStart + searchEnd) / 2;
+				if ((mortonPrims[searchStart].mortonCode & mask) == (mortonPrims[mid].mortonCode & mask))
+					searchStart = mid;
+				else
+					searchEnd = mid;
+			}
+			splitOffset = searchEnd;
+		}
+
+		(*totalNodes)++;
+		BVHBuildNode *node = buildNodes++;
+		BVHBuildNode *lbvh[2] = {
+			EmitLBVH(buildNodes, primitiveInfo, mortonPrims, splitOffset, totalNodes,
+				orderedPrims, orderedPrimsOffset, bitIndex - 1),
+			EmitLBVH(buildNodes, primitiveInfo, &mortonPrims[splitOffset], nPrimitives - splitOffset,
+				totalNodes, orderedPrims, orderedPrimsOffset, bitIndex - 1)
+		};
+		// Codes interleave the axes as ...xyzxyz, with z in the lowest bit
+		int axis = bitIndex < 0 ? 0 : 2 - bitIndex % 3;
+		node->InitInterior(axis, lbvh[0], lbvh[1]);
+		return node;
+	}
+
+	BVHBuildNode *BVHAccel::BuildUpperSAH(MemoryPool &pool, std::vector<BVHBuildNode *> &treeletRoots,
+		int start, int end, int *totalNodes) const {
+		HEBEX_ASSERT(start < end);
+		int nNodes = end - start;
+		if (nNodes == 1) return treeletRoots[start];
+		(*totalNodes)++;
+		BVHBuildNode *node = pool.Alloc<BVHBuildNode>();
+
+		BBox bounds;
+		for (int i = start; i < end; ++i)
+			bounds = Union(bounds, treeletRoots[i]->bounds);
+
+		auto centroid = [](const BVHBuildNode *n) {
+			return .5f * n->bounds.pMin + .5f * n->bounds.pMax;
+		};
+		BBox centroidBounds;
+		for (int i = start; i < end; ++i)
+			centroidBounds = Union(centroidBounds, centroid(treeletRoots[i]));
+		int dim = centroidBounds.MaximumExtent();
+
+		int mid = (start + end) / 2;
+		if (centroidBounds.pMax[dim] != centroidBounds.pMin[dim]) {
+			struct BucketInfo {
+				int count = 0;
+				BBox bounds;
+			};
+			BucketInfo buckets[nBuckets];
+			float invExtent = 1.f / (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]);
+			auto bucketOf = [&](const BVHBuildNode *n) {
+				int b = nBuckets * ((centroid(n)[dim] - centroidBounds.pMin[dim]) * invExtent);
+				return b == nBuckets ? nBuckets - 1 : b;
+			};
+			for (int i = start; i < end; ++i) {
+				int b = bucketOf(treeletRoots[i]);
+				buckets[b].count++;
+				buckets[b].bounds = Union(buckets[b].bounds, treeletRoots[i]->bounds);
+			}
+
+			float cost[nBuckets - 1];
+			for (int i = 0; i < nBuckets - 1; ++i) {
+				BBox b0, b1;
+				int count0 = 0, count1 = 0;
+				for (int j = 0; j <= i; ++j) {
+					b0 = Union(b0, buckets[j].bounds);
+					count0 += buckets[j].count;
+				}
+				for (int j = i + 1; j < nBuckets; ++j) {
+					b1 = Union(b1, buckets[j].bounds);
+					count1 += buckets[j].count;
+				}
+				cost[i] = .125f + (count0 * b0.SurfaceArea() + count1 * b1.SurfaceArea()) / bounds.SurfaceArea();
+			}
+
+			int minCostSplitBucket = 0;
+			for (int i = 1; i < nBuckets - 1; ++i)
+				if (cost[i] < cost[minCostSplitBucket]) minCostSplitBucket = i;
+
+			BVHBuildNode **pmid = std::partition(&treeletRoots[start], &treeletRoots[end - 1] + 1,
+				[&](const BVHBuildNode *n) { return bucketOf(n) <= minCostSplitBucket; });
+			mid = pmid - &treeletRoots[0];
+		}
+
+		node->InitInterior(dim,
+			BuildUpperSAH(pool, treeletRoots, start, mid, totalNodes),
+			BuildUpperSAH(pool, treeletRoots, mid, end, totalNodes));
+		return node;
+	}
+
+	BVHBuildNode *BVHAccel::BuildUpperLBVH(MemoryPool &pool, std::vector<BVHBuildNode *> &treeletRoots,
+		const std::vector<uint64_t> &treeletCodes, int start, int end, int bitIndex, int *totalNodes) const {
+		HEBEX_ASSERT(start < end);
+		if (end - start == 1) return treeletRoots[start];
+
+		// Treelets differ in their leading bits, so a split bit always exists
+		uint64_t mask = uint64_t(1) << bitIndex;
+		if ((treeletCodes[start] & mask) == (treeletCodes[end - 1] & mask))
+			return BuildUpperLBVH(pool, treeletRoots, treeletCodes, start, end, bitIndex - 1, totalNodes);
+
+		int searchStart = start, searchEnd = end - 1;
+		while (searchStart + 1 != searchEnd) {
+			int mid = (searchStart + searchEnd) / 2;
+			if ((treeletCodes[searchStart] & mask) == (treeletCodes[mid] & mask))
+				searchStart = mid;
+			else
+				searchEnd = mid;
+		}
+
+		(*totalNodes)++;
+		BVHBuildNode *node = pool.Alloc<BVHBuildNode>();
+		node->InitInterior(2 - bitIndex % 3,
+			BuildUpperLBVH(pool, treeletRoots, treeletCodes, start, searchEnd, bitIndex - 1, totalNodes),
+			BuildUpperLBVH(pool, treeletRoots, treeletCodes, searchEnd, end, bitIndex - 1, totalNodes));
+		return node;
+	}
+
+	int BVHAccel::FlattenBVHTree(BVHBuildNode *node, int depth, int *offset) {
+		LinearBVHNode *linearNode = &mNodes[*offset];
+		linearNode->bounds = node->bounds;
+		int myOffset = (*offset)++;
+		if (node->nPrimitives > 0) {
+			linearNode->primitivesOffset = node->firstPrimOffset;
+			linearNode->nPrimitives = node->nPrimitives;
+			mMaxDepth = std::max(mMaxDepth, depth);
+		}
+		else {
+			linearNode->axis = node->splitAxis;
+			linearNode->nPrimitives = 0;
+			FlattenBVHTree(node->children[0], depth + 1, offset);
+			linearNode->secondChildOffset = FlattenBVHTree(node->children[1], depth + 1, offset);
+		}
+		return myOffset;
+	}
+
+	void BVHAccel::CollectRefitTasks(int nodeIndex, int end, int depth, int maxDepth) {
+		const LinearBVHNode &node = mNodes[nodeIndex];
+		if (node.nPrimitives > 0 || depth == maxDepth) {
+			mRefitTasks.push_back({ nodeIndex, end });
+			return;
+		}
+		mRefitTopNodes.push_back(nodeIndex);
+		CollectRefitTasks(nodeIndex + 1, node.secondChildOffset, depth + 1, maxDepth);
+		CollectRefitTasks(node.secondChildOffset, end, depth + 1, maxDepth);
+	}
+
+	void BVHAccel::Refit() {
+		if (!mNodes) return;
+		if (mRefitTasks.empty()) {
+			// Enough subtrees to balance the load across the pool
+			int maxDepth = Log2Int(4 * MaxThreadIndex()) + 1;
+			CollectRefitTasks(0, mTotalNodes, 0, maxDepth);
+		}
+
+		// Children are stored after their parent, so walking a depth-first
+		// range backwards visits every child before its parent
+		auto refitNode = [this](int index) {
+			LinearBVHNode &node = mNodes[index];
+			if (node.nPrimitives > 0) {
+				BBox bounds;
+				for (int i = 0; i < node.nPrimitives; ++i)
+					bounds = Union(bounds, mPrimitiveRefs[node.primitivesOffset + i].WorldBound());
+				node.bounds = bounds;
+			}
+			else
+				node.bounds = Union(mNodes[index + 1].bounds, mNodes[node.secondChildOffset].bounds);
+		};
+
+		ParallelFor([&](int64_t t) {
+			const RefitTask &task = mRefitTasks[t];
+			for (int i = task.end - 1; i >= task.start; --i)
+				refitNode(i);
+		}, mRefitTasks.size());
+
+		for (int i = (int)mRefitTopNodes.size() - 1; i >= 0; --i)
+			refitNode(mRefitTopNodes[i]);
+	}
+
+	float BVHAccel::SAHCost() const {
+		if (!mNodes) return 0.f;
+		const int chunkSize = 16384;
+		const int nChunks = (mTotalNodes + chunkSize - 1) / chunkSize;
+		std::vector<double> chunkCost(nChunks, 0.);
+		ParallelFor([&](int64_t chunk) {
+			int end = std::min<int>(mTotalNodes, (chunk + 1) * chunkSize);
+			double cost = 0.;
+			for (int i = chunk * chunkSize; i < end; ++i) {
+				const LinearBVHNode &node = mNodes[i];
+				float weight = node.nPrimitives > 0 ? float(node.nPrimitives) : .125f;
+				cost += weight * node.bounds.SurfaceArea();
+			}
+			chunkCost[chunk] = cost;
+		}, nChunks);
+
+		double totalCost = 0.;
+		for (double cost : chunkCost) totalCost += cost;
+		float rootArea = mNodes[0].bounds.SurfaceArea();
+		return rootArea > 0.f ? float(totalCost / rootArea) : 0.f;
+	}
+
+	bool BVHAccel::Update(float maxCostRatio) {
+		Refit();
+		if (SAHCost() <= maxCostRatio * mBuildSAHCost) return false;
+		Build();
+		return true;
+	}
+
+	// Replays node and leaf fetches through a CacheSimulator
+	struct CacheVisitor {
+		void operator()(const void *address, size_t size) { cache->Access(address, size); }
+		CacheSimulator *cache;
+	};
+
+	struct NullVisitor {
+		void operator()(const void *, size_t) {}
+	};
+
+	template <bool AnyHit, typename MemoryVisitor>
+	bool BVHAccel::Traverse(const Ray &ray, SurfaceHit *hit, MemoryVisitor &visit) const {
+		if (!mNodes) return false;
+		bool hitSomething = false;
+		Vec3f invDir(1.f / ray.mDirection.x, 1.f / ray.mDirection.y, 1.f / ray.mDirection.z);
+		int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+		// At most one pending node per level. LBVH trees over 63-bit Morton
+		// codes can be deeper than the usual fixed stack.
+		int toVisitOffset = 0, currentNodeIndex = 0;
+		int stackBuffer[64];
+		int *nodesToVisit = mMaxDepth <= 64 ? stackBuffer : ALLOCA(int, mMaxDepth);
+		while (true) {
+			const LinearBVHNode *node = &mNodes[currentNodeIndex];
+			visit(node, sizeof(LinearBVHNode));
+			// ray.tMax shrinks with every hit, culling farther nodes
+			if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
+				if (node->nPrimitives > 0) {
+					visit(&mPrimitiveRefs[node->primitivesOffset], node->nPrimitives * sizeof(PrimitiveRef));
+					for (int i = 0; i < node->nPrimitives; ++i) {
+						const PrimitiveRef *prim = &mPrimitiveRefs[node->primitivesOffset + i];
+						if (AnyHit) {
+							if (prim->IntersectP(ray)) return true;
+						}
+						else if (prim->IntersectHit(ray, hit)) {
+							hit->RecordIndex(node->primitivesOffset + i);
+							hitSomething = true;
+						}
+					}
+					if (toVisitOffset == 0) break;
+					currentNodeIndex = nodesToVisit[--toVisitOffset];
+				}
+				else {
+					// Visit the near child first
+					if (dirIsNeg[node->axis]) {
+						nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+						currentNodeIndex = node->secondChildOffset;
+					}
+					else {
+						nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+						currentNodeIndex = currentNodeIndex + 1;
+					}
+				}
+			}
+			else {
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+		}
+		return hitSomething;
+	}
+
+	bool BVHAccel::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		NullVisitor visit;
+		return Traverse<false>(ray, hit, visit);
+	}
+
+	bool BVHAccel::IntersectHit(const Ray &ray, SurfaceHit *hit, CacheSimulator *cache) const {
+		CacheVisitor visit = { cache };
+		return Traverse<false>(ray, hit, visit);
+	}
+
+	void BVHAccel::ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		if (hit.instanceId == InvalidHitId) {
+			mPrimitiveRefs[hit.primId].ComputeIntersection(ray, hit, isect);
+			return;
+		}
+		// The instance is ours; the primitive id belongs to the aggregate below
+		SurfaceHit inner = hit;
+		inner.instanceId = InvalidHitId;
+		mPrimitiveRefs[hit.instanceId].ComputeIntersection(ray, inner, isect);
+	}
+
+	bool BVHAccel::IntersectP(const Ray &ray) const {
+		NullVisitor visit;
+		return Traverse<true>(ray, nullptr, visit);
+	}
+}
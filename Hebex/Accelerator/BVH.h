@@ -0,0 +1,128 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "PrimitiveRef.h"
+#include <atomic>
+
+namespace Hebex
+{
+	struct BVHBuildNode;
+	struct BVHPrimitiveInfo;
+	struct MortonPrimitive;
+	struct LBVHTreelet;
+
+	// Depth-first flattened node: the first child directly follows its parent,
+	// the second child is found through secondChildOffset
+	struct alignas(32) LinearBVHNode {
+		BBox bounds;
+		union {
+			int primitivesOffset;   // leaf
+			int secondChildOffset;  // interior
+		};
+		uint16_t nPrimitives;
+		uint8_t axis;
+		uint8_t pad[1];
+	};
+
+	class BVHAccel : public Primitive {
+	public:
+		// SAH: sequential binned SAH build.
+		// LBVH: parallel linear build; primitives are sorted by the Morton code of
+		// their centroid and split on code bits at every level.
+		// HLBVH: LBVH treelets built in parallel, joined by a binned SAH build
+		// over the treelet roots.
+		enum class SplitMethod { SAH, LBVH, HLBVH };
+
+		// mortonBits selects 30-bit (10 per axis) or 63-bit (21 per axis) codes
+		BVHAccel(const std::vector<std::shared_ptr<Primitive> > &p, int maxPrimsInNode = 4,
+			SplitMethod splitMethod = SplitMethod::SAH, int mortonBits = 30);
+
+		~BVHAccel();
+
+		BBox WorldBound() const;
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		// Closest hit that also replays every node and leaf fetch through
+		// cache, for measuring how coherent a sequence of rays is
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit, CacheSimulator *cache) const;
+
+		const LinearBVHNode *GetNodes() const { return mNodes; }
+
+		// Edges on the longest path from the root to a leaf; bounds the
+		// number of nodes pending during a traversal
+		int GetMaxDepth() const { return mMaxDepth; }
+
+		int GetTotalNodes() const { return mTotalNodes; }
+
+		// The primitives the tree was built from, in input order
+		const std::vector<std::shared_ptr<Primitive> > &GetPrimitives() const { return mPrimitives; }
+
+		// Leaf entries in leaf order, as referenced by primitivesOffset; a
+		// mesh contributes one per triangle
+		const std::vector<PrimitiveRef> &GetPrimitiveRefs() const { return mPrimitiveRefs; }
+
+		// Recomputes every node's bounds bottom-up from the primitives' current
+		// WorldBound, keeping the topology. Must not run concurrently with traversal.
+		void Refit();
+
+		// Expected cost of a random ray relative to intersecting one primitive:
+		// interior nodes weigh .125 and leaves their primitive count, each
+		// scaled by its surface area relative to the root
+		float SAHCost() const;
+
+		float GetBuildSAHCost() const { return mBuildSAHCost; }
+
+		// Per-frame update for moving primitives: refits, then rebuilds if the
+		// tree degraded beyond maxCostRatio times its cost when built.
+		// Returns true if a rebuild happened.
+		bool Update(float maxCostRatio = 1.5f);
+
+	private:
+		struct RefitTask {
+			int start, end;  // contiguous depth-first subtree
+		};
+
+		void Build();
+
+		template <bool AnyHit, typename MemoryVisitor>
+		bool Traverse(const Ray &ray, SurfaceHit *hit, MemoryVisitor &visit) const;
+
+		void CollectRefitTasks(int nodeIndex, int end, int depth, int maxDepth);
+		BVHBuildNode *RecursiveBuild(MemoryPool &pool, std::vector<BVHPrimitiveInfo> &primitiveInfo,
+			int start, int end, int *totalNodes, std::vector<PrimitiveRef> &orderedPrims);
+
+		BVHBuildNode *HLBVHBuild(MemoryPool &pool, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+			int *totalNodes, std::vector<PrimitiveRef> &orderedPrims) const;
+
+		BVHBuildNode *EmitLBVH(BVHBuildNode *&buildNodes, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+			MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
+			std::vector<PrimitiveRef> &orderedPrims, std::atomic<int> *orderedPrimsOffset, int bitIndex) const;
+
+		BVHBuildNode *BuildUpperSAH(MemoryPool &pool, std::vector<BVHBuildNode *> &treeletRoots,
+			int start, int end, int *totalNodes) const;
+
+		BVHBuildNode *BuildUpperLBVH(MemoryPool &pool, std::vector<BVHBuildNode *> &treeletRoots,
+			const std::vector<uint64_t> &treeletCodes, int start, int end, int bitIndex, int *totalNodes) const;
+
+		int FlattenBVHTree(BVHBuildNode *node, int depth, int *offset);
+
+		const int mMaxPrimsInNode;
+		const SplitMethod mSplitMethod;
+		const int mMortonBits;
+		std::vector<std::shared_ptr<Primitive> > mPrimitives;  // owners of the leaf entries
+		std::vector<PrimitiveRef> mPrimitiveRefs;
+		LinearBVHNode *mNodes = nullptr;
+		int mTotalNodes = 0;
+		int mMaxDepth = 0;
+		float mBuildSAHCost = 0.f;
+		std::vector<RefitTask> mRefitTasks;
+		std::vector<int> mRefitTopNodes;
+	};
+}
+
+#endif
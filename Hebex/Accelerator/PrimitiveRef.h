@@ -0,0 +1,100 @@
+#ifndef PRIMITIVEREF_H
+#define PRIMITIVEREF_H
+
+#include "../Core/Primitive.h"
+#include "../Core/Ray.h"
+#include "../Core/Intersection.h"
+#include "../Shape/Sphere.h"
+#include "../Shape/Triangle.h"
+
+namespace Hebex
+{
+	// Leaf entry of an aggregate, tagged with the type of the shape behind a
+	// GeometricPrimitive. Spheres and mesh triangles are intersected by a
+	// switch over direct calls instead of the two virtual calls through
+	// Primitive and Shape; a mesh is expanded into one (mesh, triangle index)
+	// entry per triangle. Any other primitive, including instances and nested
+	// aggregates, falls back to the Primitive interface.
+	struct PrimitiveRef {
+		PrimitiveRef() {}
+
+		// Appends the entries of prim, one per triangle for a mesh
+		static void Append(const Primitive *prim, std::vector<PrimitiveRef> *refs) {
+			const GeometricPrimitive *gp = dynamic_cast<const GeometricPrimitive *>(prim);
+			ShapeType type = gp ? gp->GetShape()->GetType() : ShapeType::Generic;
+			if (type == ShapeType::Generic)
+				refs->push_back(PrimitiveRef(prim, type, 0));
+			else if (type == ShapeType::Sphere)
+				refs->push_back(PrimitiveRef(gp->GetShape().get(), type, 0));
+			else {
+				const TriangleMesh *mesh = static_cast<const TriangleMesh *>(gp->GetShape().get());
+				for (int i = 0; i < mesh->GetTriangleCount(); ++i)
+					refs->push_back(PrimitiveRef(mesh, type, i));
+			}
+		}
+
+		BBox WorldBound() const {
+			switch (type) {
+			case ShapeType::Sphere:
+				return static_cast<const Sphere *>(ptr)->WorldBound();
+			case ShapeType::TriangleMesh:
+				return static_cast<const TriangleMesh *>(ptr)->TriangleBound(index);
+			default:
+				return static_cast<const Primitive *>(ptr)->WorldBound();
+			}
+		}
+
+		// Same contract as Primitive::IntersectHit
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+			switch (type) {
+			case ShapeType::Sphere:
+				if (!static_cast<const Sphere *>(ptr)->Sphere::IntersectHit(ray, hit)) return false;
+				break;
+			case ShapeType::TriangleMesh:
+				if (!static_cast<const TriangleMesh *>(ptr)->IntersectTriangle(index, ray, hit)) return false;
+				break;
+			default:
+				return static_cast<const Primitive *>(ptr)->IntersectHit(ray, hit);
+			}
+			// What GeometricPrimitive::IntersectHit does after the shape test
+			hit->primId = hit->instanceId = InvalidHitId;
+			ray.tMax = hit->t;
+			return true;
+		}
+
+		void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+			switch (type) {
+			case ShapeType::Sphere:
+				static_cast<const Sphere *>(ptr)->Sphere::ComputeSurfaceInteraction(ray, hit, isect);
+				break;
+			case ShapeType::TriangleMesh:
+				static_cast<const TriangleMesh *>(ptr)->ComputeTriangleInteraction(index, ray, hit, isect);
+				break;
+			default:
+				static_cast<const Primitive *>(ptr)->ComputeIntersection(ray, hit, isect);
+			}
+		}
+
+		bool IntersectP(const Ray &ray) const {
+			switch (type) {
+			case ShapeType::Sphere:
+				return static_cast<const Sphere *>(ptr)->Sphere::IntersectP(ray);
+			case ShapeType::TriangleMesh:
+				return static_cast<const TriangleMesh *>(ptr)->IntersectTriangleP(index, ray);
+			default:
+				return static_cast<const Primitive *>(ptr)->IntersectP(ray);
+			}
+		}
+
+		const void *ptr = nullptr;  // the shape when tagged, else the Primitive
+		int index = 0;              // triangle of a mesh
+		ShapeType type = ShapeType::Generic;
+
+	private:
+		PrimitiveRef(const void *ptr, ShapeType type, int index) : ptr(ptr), index(index), type(type) {}
+	};
+
+	static_assert(sizeof(PrimitiveRef) <= 16, "PrimitiveRef should stay at 16 bytes");
+}
+
+#endif
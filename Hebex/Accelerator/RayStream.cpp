@@ -0,0 +1,102 @@
+#include "RayStream.h"
+#include "../Core/Parallel.h"
+#include "../Core/CacheSimulator.h"
+#include "../Core/Utils.h"
+
+namespace Hebex
+{
+	// Bits per axis of the direction code that orders rays within one cell
+	static const int nDirectionBits = 4;
+
+	// Rays per ParallelFor work item; each item is a contiguous run of the
+	// sorted order, so coherence is kept within a thread
+	static const int traceChunkSize = 256;
+
+	RayStream::RayStream(const BVHAccel &bvh, bool sortRays, int originBits) :
+		mBVH(bvh), mSortRays(sortRays), mOriginBits(Clamp(originBits, 1, 16)), mBounds(bvh.WorldBound()) {
+	}
+
+	int RayStream::Enqueue(const Ray &ray) {
+		mRays.push_back(ray);
+		return (int)mRays.size() - 1;
+	}
+
+	void RayStream::Clear() {
+		mRays.clear();
+		mHits.clear();
+		mHitFlags.clear();
+		mOrder.clear();
+	}
+
+	uint64_t RayStream::ComputeKey(const Ray &ray) const {
+		const Vec3f &d = ray.mDirection;
+		uint64_t octant = (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+
+		// Origins outside the scene bounds are clamped to the border cells
+		float scale = float(1 << mOriginBits);
+		uint64_t maxCell = (uint64_t(1) << mOriginBits) - 1;
+		uint64_t cell[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			float extent = mBounds.pMax[axis] - mBounds.pMin[axis];
+			float o = extent > 0.f ? (ray.mOrigin[axis] - mBounds.pMin[axis]) / extent : 0.f;
+			cell[axis] = std::min(uint64_t(std::max(0.f, o * scale)), maxCell);
+		}
+		uint64_t originCode = (LeftShift3(cell[0]) << 2) | (LeftShift3(cell[1]) << 1) | LeftShift3(cell[2]);
+
+		// The octant already holds the signs, so only magnitudes are quantized
+		float maxComponent = std::max(std::abs(d.x), std::max(std::abs(d.y), std::abs(d.z)));
+		uint64_t dirCode = 0;
+		if (maxComponent > 0.f) {
+			const float dirScale = float((1 << nDirectionBits) - 1) / maxComponent;
+			dirCode = (LeftShift3(uint64_t(std::abs(d.x) * dirScale)) << 2) |
+				(LeftShift3(uint64_t(std::abs(d.y) * dirScale)) << 1) |
+				LeftShift3(uint64_t(std::abs(d.z) * dirScale));
+		}
+
+		int dirShift = 3 * nDirectionBits;
+		int octantShift = dirShift + 3 * mOriginBits;
+		return (octant << octantShift) | (originCode << dirShift) | dirCode;
+	}
+
+	void RayStream::Trace() {
+		const int nRays = (int)mRays.size();
+		mHits.resize(nRays);
+		mHitFlags.assign(nRays, 0);
+
+		mOrder.resize(nRays);
+		for (int i = 0; i < nRays; ++i) {
+			mOrder[i].slot = i;
+			mOrder[i].key = mSortRays ? ComputeKey(mRays[i]) : 0;
+		}
+		if (mSortRays)
+			std::sort(mOrder.begin(), mOrder.end(), [](const SortKey &a, const SortKey &b) {
+				return a.key < b.key || (a.key == b.key && a.slot < b.slot);
+			});
+
+		// Results go straight to the ray's slot, which scatters them back
+		// into queue order
+		if (mCache) {
+			for (int i = 0; i < nRays; ++i) {
+				int slot = mOrder[i].slot;
+				mHitFlags[slot] = mBVH.IntersectHit(mRays[slot], &mHits[slot], mCache);
+			}
+		}
+		else {
+			int nChunks = (nRays + traceChunkSize - 1) / traceChunkSize;
+			ParallelFor([&](int64_t chunk) {
+				int start = (int)chunk * traceChunkSize;
+				int end = std::min(start + traceChunkSize, nRays);
+				for (int i = start; i < end; ++i) {
+					int slot = mOrder[i].slot;
+					mHitFlags[slot] = mBVH.IntersectHit(mRays[slot], &mHits[slot]);
+				}
+			}, nChunks);
+		}
+		mRaysTraced += nRays;
+	}
+
+	void RayStream::GetIntersection(int slot, Intersection *isect) const {
+		HEBEX_ASSERT(mHitFlags[slot]);
+		mBVH.ComputeIntersection(mRays[slot], mHits[slot], isect);
+	}
+}
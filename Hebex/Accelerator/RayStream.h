@@ -0,0 +1,69 @@
+#ifndef RAYSTREAM_H
+#define RAYSTREAM_H
+
+#include "BVH.h"
+#include "../Core/Ray.h"
+#include "../Core/Intersection.h"
+
+namespace Hebex
+{
+	// Queue of rays traced together against a BVH. Before traversal the rays
+	// are reordered by direction octant, then by the Morton code of the grid
+	// cell holding their origin, then by a coarse direction code, so that
+	// consecutive rays walk mostly the same nodes. Results are written back
+	// to the slot each ray was queued in.
+	class RayStream {
+	public:
+		// sortRays = false traces in queue order, as a baseline.
+		// originBits is the grid resolution per axis over the BVH bounds.
+		RayStream(const BVHAccel &bvh, bool sortRays = true, int originBits = 8);
+
+		// Returns the ray's slot
+		int Enqueue(const Ray &ray);
+
+		// Closest hit for every queued ray. Rays are traced in parallel unless
+		// a cache simulator is set.
+		void Trace();
+
+		void Clear();
+
+		int Size() const { return (int)mRays.size(); }
+
+		// tMax is the hit distance after Trace()
+		const Ray &GetRay(int slot) const { return mRays[slot]; }
+
+		bool Hit(int slot) const { return mHitFlags[slot] != 0; }
+
+		const SurfaceHit &GetHit(int slot) const { return mHits[slot]; }
+
+		// Geometry of a ray's hit, rebuilt on demand from its SurfaceHit
+		void GetIntersection(int slot, Intersection *isect) const;
+
+		// Replays every node fetch of the following Trace() calls through cache.
+		// Divide its GetMisses() by GetRaysTraced() for the misses per ray.
+		void SetCacheSimulator(CacheSimulator *cache) { mCache = cache; }
+
+		uint64_t GetRaysTraced() const { return mRaysTraced; }
+
+	private:
+		struct SortKey {
+			uint64_t key;
+			int slot;
+		};
+
+		uint64_t ComputeKey(const Ray &ray) const;
+
+		const BVHAccel &mBVH;
+		const bool mSortRays;
+		const int mOriginBits;
+		BBox mBounds;
+		std::vector<Ray> mRays;
+		std::vector<SurfaceHit> mHits;
+		std::vector<uint8_t> mHitFlags;
+		std::vector<SortKey> mOrder;
+		CacheSimulator *mCache = nullptr;
+		uint64_t mRaysTraced = 0;
+	};
+}
+
+#endif
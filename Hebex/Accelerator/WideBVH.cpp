@@ -0,0 +1,247 @@
+#include "WideBVH.h"
+#include "../Core/MemoryPool.h"
+#include "../Core/Simd.h"
+#include "../Core/Ray.h"
+#include "../Core/Intersection.h"
+
+namespace Hebex
+{
+	// Per-ray constants of the slab test, computed once per traversal
+	struct SlabRay {
+		SlabRay(const Ray &ray) {
+			for (int i = 0; i < 3; ++i) {
+				origin[i] = ray.mOrigin[i];
+				invDir[i] = 1.f / ray.mDirection[i];
+				dirIsNeg[i] = invDir[i] < 0;
+			}
+		}
+
+		float origin[3], invDir[3];
+		int dirIsNeg[3];
+	};
+
+	static inline int IntersectChildren(const WideBVHNode<4> &node, const SlabRay &r,
+		float tMin, float tMax, float tNear[4]) {
+		__m128 t0 = _mm_set1_ps(tMin);
+		__m128 t1 = _mm_set1_ps(tMax);
+		// Far distances are widened by their rounding error, as in BBox::IntersectP
+		const __m128 farScale = _mm_set1_ps(1 + 2 * Gamma(3));
+		for (int axis = 0; axis < 3; ++axis) {
+			__m128 o = _mm_set1_ps(r.origin[axis]);
+			__m128 invDir = _mm_set1_ps(r.invDir[axis]);
+			__m128 nearPlane = _mm_load_ps(node.bounds[r.dirIsNeg[axis]][axis]);
+			__m128 farPlane = _mm_load_ps(node.bounds[1 - r.dirIsNeg[axis]][axis]);
+			t0 = _mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(nearPlane, o), invDir));
+			t1 = _mm_min_ps(t1, _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(farPlane, o), invDir), farScale));
+		}
+		_mm_storeu_ps(tNear, t0);
+		return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+	}
+
+	HEBEX_TARGET_AVX2
+	static int IntersectChildren(const WideBVHNode<8> &node, const SlabRay &r,
+		float tMin, float tMax, float tNear[8]) {
+		__m256 t0 = _mm256_set1_ps(tMin);
+		__m256 t1 = _mm256_set1_ps(tMax);
+		const __m256 farScale = _mm256_set1_ps(1 + 2 * Gamma(3));
+		for (int axis = 0; axis < 3; ++axis) {
+			__m256 o = _mm256_set1_ps(r.origin[axis]);
+			__m256 invDir = _mm256_set1_ps(r.invDir[axis]);
+			__m256 nearPlane = _mm256_load_ps(node.bounds[r.dirIsNeg[axis]][axis]);
+			__m256 farPlane = _mm256_load_ps(node.bounds[1 - r.dirIsNeg[axis]][axis]);
+			t0 = _mm256_max_ps(t0, _mm256_mul_ps(_mm256_sub_ps(nearPlane, o), invDir));
+			t1 = _mm256_min_ps(t1, _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(farPlane, o), invDir), farScale));
+		}
+		_mm256_storeu_ps(tNear, t0);
+		return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+	}
+
+	WideBVHAccel::WideBVHAccel(const std::vector<std::shared_ptr<Primitive> > &p, int maxPrimsInNode) {
+		BVHAccel bvh(p, maxPrimsInNode);
+		mPrimitives = bvh.GetPrimitives();
+		mPrimitiveRefs = bvh.GetPrimitiveRefs();
+		mBounds = bvh.WorldBound();
+		mMaxDepth = bvh.GetMaxDepth();
+		if (bvh.GetTotalNodes() == 0) return;
+
+		if (HasAVX2()) Collapse<8>(bvh);
+		else Collapse<4>(bvh);
+	}
+
+	WideBVHAccel::~WideBVHAccel() {
+		FreeAligned(mNodes);
+	}
+
+	BBox WideBVHAccel::WorldBound() const {
+		return mBounds;
+	}
+
+	template <int W>
+	void WideBVHAccel::Collapse(const BVHAccel &bvh) {
+		const LinearBVHNode *binaryNodes = bvh.GetNodes();
+		std::vector<int> rootChildren;
+		if (binaryNodes[0].nPrimitives > 0)
+			rootChildren.push_back(0);
+		else {
+			rootChildren.push_back(1);
+			rootChildren.push_back(binaryNodes[0].secondChildOffset);
+		}
+
+		std::vector<WideBVHNode<W> > nodes;
+		nodes.reserve(bvh.GetTotalNodes() / (W - 1) + 1);
+		CollapseNode<W>(binaryNodes, rootChildren, nodes);
+
+		mWidth = W;
+		mTotalNodes = nodes.size();
+		WideBVHNode<W> *wideNodes = AllocAligned<WideBVHNode<W> >(nodes.size());
+		FirstTouch(wideNodes, nodes.size() * sizeof(WideBVHNode<W>));
+		memcpy(wideNodes, nodes.data(), nodes.size() * sizeof(WideBVHNode<W>));
+		mNodes = wideNodes;
+	}
+
+	template <int W>
+	int WideBVHAccel::CollapseNode(const LinearBVHNode *binaryNodes, std::vector<int> children,
+		std::vector<WideBVHNode<W> > &nodes) {
+		// Pull up grandchildren, opening the largest interior child first,
+		// until all W lanes are filled or only leaves remain
+		while ((int)children.size() < W) {
+			int best = -1;
+			float bestArea = -1.f;
+			for (size_t i = 0; i < children.size(); ++i) {
+				const LinearBVHNode &c = binaryNodes[children[i]];
+				if (c.nPrimitives == 0 && c.bounds.SurfaceArea() > bestArea) {
+					bestArea = c.bounds.SurfaceArea();
+					best = i;
+				}
+			}
+			if (best < 0) break;
+			int index = children[best];
+			children[best] = index + 1;
+			children.push_back(binaryNodes[index].secondChildOffset);
+		}
+
+		int nodeIndex = nodes.size();
+		nodes.push_back(WideBVHNode<W>());
+		for (int i = 0; i < W; ++i) {
+			WideBVHNode<W> &node = nodes[nodeIndex];
+			for (int axis = 0; axis < 3; ++axis) {
+				node.bounds[0][axis][i] = INFINITY;
+				node.bounds[1][axis][i] = -INFINITY;
+			}
+			node.offset[i] = -1;
+			node.nPrimitives[i] = 0;
+		}
+
+		for (size_t i = 0; i < children.size(); ++i) {
+			const LinearBVHNode &c = binaryNodes[children[i]];
+			int offset, nPrimitives;
+			if (c.nPrimitives > 0) {
+				offset = c.primitivesOffset;
+				nPrimitives = c.nPrimitives;
+			}
+			else {
+				std::vector<int> grandChildren;
+				grandChildren.push_back(children[i] + 1);
+				grandChildren.push_back(c.secondChildOffset);
+				offset = CollapseNode<W>(binaryNodes, grandChildren, nodes);
+				nPrimitives = 0;
+			}
+			// The recursion may have reallocated the node array
+			WideBVHNode<W> &node = nodes[nodeIndex];
+			for (int axis = 0; axis < 3; ++axis) {
+				node.bounds[0][axis][i] = c.bounds.pMin[axis];
+				node.bounds[1][axis][i] = c.bounds.pMax[axis];
+			}
+			node.offset[i] = offset;
+			node.nPrimitives[i] = nPrimitives;
+		}
+		return nodeIndex;
+	}
+
+	template <int W, bool AnyHit>
+	bool WideBVHAccel::Traverse(const WideBVHNode<W> *nodes, const Ray &ray, SurfaceHit *hit) const {
+		struct StackEntry {
+			int offset, nPrimitives;
+			float tNear;
+		};
+		// Each level leaves at most W - 1 pending siblings
+		StackEntry stackBuffer[64 * W];
+		StackEntry *stack = mMaxDepth <= 64 ? stackBuffer : ALLOCA(StackEntry, W * mMaxDepth);
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0, ray.tMin };
+
+		SlabRay slabRay(ray);
+		bool hitSomething = false;
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+			// Entries pushed before a closer hit was found may now be culled
+			if (entry.tNear > ray.tMax) continue;
+
+			if (entry.nPrimitives > 0) {
+				for (int i = 0; i < entry.nPrimitives; ++i) {
+					const PrimitiveRef *prim = &mPrimitiveRefs[entry.offset + i];
+					if (AnyHit) {
+						if (prim->IntersectP(ray)) return true;
+					}
+					else if (prim->IntersectHit(ray, hit)) {
+						hit->RecordIndex(entry.offset + i);
+						hitSomething = true;
+					}
+				}
+				continue;
+			}
+
+			const WideBVHNode<W> &node = nodes[entry.offset];
+			float tNear[W];
+			uint32_t mask = IntersectChildren(node, slabRay, ray.tMin, ray.tMax, tNear);
+
+			// Push hit children far-to-near so the nearest is popped first
+			int nHit = 0;
+			StackEntry hitChildren[W];
+			while (mask) {
+				int i = CountTrailingZeros(mask);
+				mask &= mask - 1;
+				StackEntry child = { node.offset[i], node.nPrimitives[i], tNear[i] };
+				int j = nHit++;
+				for (; j > 0 && hitChildren[j - 1].tNear < child.tNear; --j)
+					hitChildren[j] = hitChildren[j - 1];
+				hitChildren[j] = child;
+			}
+			for (int i = 0; i < nHit; ++i)
+				stack[stackSize++] = hitChildren[i];
+		}
+		return hitSomething;
+	}
+
+	HEBEX_TARGET_AVX2
+	bool WideBVHAccel::IntersectHitAVX2(const Ray &ray, SurfaceHit *hit) const {
+		return Traverse<8, false>((const WideBVHNode<8> *)mNodes, ray, hit);
+	}
+
+	HEBEX_TARGET_AVX2
+	bool WideBVHAccel::IntersectPAVX2(const Ray &ray) const {
+		return Traverse<8, true>((const WideBVHNode<8> *)mNodes, ray, nullptr);
+	}
+
+	bool WideBVHAccel::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		if (!mNodes) return false;
+		if (mWidth == 8) return IntersectHitAVX2(ray, hit);
+		return Traverse<4, false>((const WideBVHNode<4> *)mNodes, ray, hit);
+	}
+
+	void WideBVHAccel::ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		if (hit.instanceId == InvalidHitId) {
+			mPrimitiveRefs[hit.primId].ComputeIntersection(ray, hit, isect);
+			return;
+		}
+		SurfaceHit inner = hit;
+		inner.instanceId = InvalidHitId;
+		mPrimitiveRefs[hit.instanceId].ComputeIntersection(ray, inner, isect);
+	}
+
+	bool WideBVHAccel::IntersectP(const Ray &ray) const {
+		if (!mNodes) return false;
+		if (mWidth == 8) return IntersectPAVX2(ray);
+		return Traverse<4, true>((const WideBVHNode<4> *)mNodes, ray, nullptr);
+	}
+}
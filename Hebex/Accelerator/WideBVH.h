@@ -0,0 +1,63 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include "BVH.h"
+
+namespace Hebex
+{
+	// W-wide node with the children's bounds stored SoA, so a ray is tested
+	// against all children with one vectorized slab test. Unused lanes hold
+	// inverted bounds and never report a hit.
+	template <int W>
+	struct alignas(64) WideBVHNode {
+		float bounds[2][3][W];   // [pMin/pMax][axis][child]
+		int32_t offset[W];       // child node index, or first primitive of a leaf
+		uint8_t nPrimitives[W];  // 0 for interior children
+	};
+
+	// BVH collapsed to 8-wide nodes (AVX2) or 4-wide nodes (SSE) depending on
+	// the CPU the scene is built on
+	class WideBVHAccel : public Primitive {
+	public:
+		WideBVHAccel(const std::vector<std::shared_ptr<Primitive> > &p, int maxPrimsInNode = 4);
+
+		~WideBVHAccel();
+
+		BBox WorldBound() const;
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		int GetWidth() const { return mWidth; }
+
+		int GetTotalNodes() const { return mTotalNodes; }
+
+	private:
+		template <int W>
+		void Collapse(const BVHAccel &bvh);
+
+		template <int W>
+		int CollapseNode(const LinearBVHNode *binaryNodes, std::vector<int> children,
+			std::vector<WideBVHNode<W> > &nodes);
+
+		template <int W, bool AnyHit>
+		bool Traverse(const WideBVHNode<W> *nodes, const Ray &ray, SurfaceHit *hit) const;
+
+		bool IntersectHitAVX2(const Ray &ray, SurfaceHit *hit) const;
+
+		bool IntersectPAVX2(const Ray &ray) const;
+
+		std::vector<std::shared_ptr<Primitive> > mPrimitives;
+		std::vector<PrimitiveRef> mPrimitiveRefs;
+		BBox mBounds;
+		int mWidth = 4;
+		int mTotalNodes = 0;
+		int mMaxDepth = 0;      // of the binary BVH, which bounds the wide one
+		void *mNodes = nullptr;
+	};
+}
+
+#endif
@@ -40,8 +40,9 @@ namespace Hebex
 
 			// Update parametric interval from slab intersection $t$s
 			if (tNear > tFar) std::swap(tNear, tFar);
+			tFar *= 1 + 2 * Gamma(3);
 			t0 = tNear > t0 ? tNear : t0;
-			t1 = tFar > t1 ? tFar : t1;
+			t1 = tFar < t1 ? tFar : t1;
 			if (t0 > t1) return false;
 		}
 		if (hitt0) *hitt0 = t0;
@@ -2,6 +2,7 @@
 #define BBOX_H
 
 #include "Geometry.h"
+#include "Ray.h"
 
 namespace Hebex
 {
@@ -80,6 +81,8 @@ namespace Hebex
 
 		bool IntersectP(const Ray &ray, float *hitt0 = NULL, float *hitt1 = NULL) const;
 
+		inline bool IntersectP(const Ray &ray, const Vec3f &invDir, const int dirIsNeg[3]) const;
+
 		bool operator==(const BBox &b) const {
 			return b.pMin == pMin && b.pMax == pMax;
 		}
@@ -100,6 +103,31 @@ namespace Hebex
 	{
 		return (&pMin)[i];
 	}
+
+	inline bool BBox::IntersectP(const Ray &ray, const Vec3f &invDir, const int dirIsNeg[3]) const {
+		// Reciprocal direction and slab order are precomputed once per ray by the caller
+		const BBox &bounds = *this;
+		float tMin = (bounds[dirIsNeg[0]].x - ray.mOrigin.x) * invDir.x;
+		float tMax = (bounds[1 - dirIsNeg[0]].x - ray.mOrigin.x) * invDir.x;
+		float tyMin = (bounds[dirIsNeg[1]].y - ray.mOrigin.y) * invDir.y;
+		float tyMax = (bounds[1 - dirIsNeg[1]].y - ray.mOrigin.y) * invDir.y;
+
+		// Widen the far distances by their rounding error so thin boxes are never missed
+		tMax *= 1 + 2 * Gamma(3);
+		tyMax *= 1 + 2 * Gamma(3);
+		if (tMin > tyMax || tyMin > tMax) return false;
+		if (tyMin > tMin) tMin = tyMin;
+		if (tyMax < tMax) tMax = tyMax;
+
+		float tzMin = (bounds[dirIsNeg[2]].z - ray.mOrigin.z) * invDir.z;
+		float tzMax = (bounds[1 - dirIsNeg[2]].z - ray.mOrigin.z) * invDir.z;
+		tzMax *= 1 + 2 * Gamma(3);
+
+		if (tMin > tzMax || tzMin > tMax) return false;
+		if (tzMin > tMin) tMin = tzMin;
+		if (tzMax < tMax) tMax = tzMax;
+		return (tMin < ray.tMax) && (tMax > ray.tMin);
+	}
 }
 
 
@@ -0,0 +1,36 @@
+#include "CacheSimulator.h"
+#include "Utils.h"
+
+namespace Hebex
+{
+	CacheSimulator::CacheSimulator(int sizeBytes, int ways, int lineSize) : mWays(ways) {
+		HEBEX_ASSERT(IsPowerOf2(lineSize) && ways > 0);
+		mLineShift = Log2Int(lineSize);
+		mSets = std::max(1, sizeBytes / (lineSize * ways));
+		mTags.resize(mSets * mWays, 0);
+	}
+
+	void CacheSimulator::Access(const void *address, size_t size) {
+		uintptr_t first = uintptr_t(address) >> mLineShift;
+		uintptr_t last = (uintptr_t(address) + std::max<size_t>(size, 1) - 1) >> mLineShift;
+		for (uintptr_t line = first; line <= last; ++line) {
+			++mAccesses;
+			// Lines are stored off by one so that 0 never matches a real line
+			uintptr_t tag = line + 1;
+			uintptr_t *set = &mTags[(line % mSets) * mWays];
+			int way = 0;
+			while (way < mWays && set[way] != tag) ++way;
+			if (way == mWays) {
+				++mMisses;
+				way = mWays - 1;  // evict the least recently used
+			}
+			for (; way > 0; --way) set[way] = set[way - 1];
+			set[0] = tag;
+		}
+	}
+
+	void CacheSimulator::Reset() {
+		std::fill(mTags.begin(), mTags.end(), 0);
+		mAccesses = mMisses = 0;
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef CACHESIMULATOR_H
+#define CACHESIMULATOR_H
+
+#include "Hebex.h"
+
+namespace Hebex
+{
+	// Set-associative LRU model of a data cache. Replaying the addresses an
+	// algorithm touches gives a deterministic miss count, independent of
+	// hardware counters, for comparing memory access orders.
+	class CacheSimulator {
+	public:
+		CacheSimulator(int sizeBytes = 32768, int ways = 8, int lineSize = L1_CACHE_LINE_SIZE);
+
+		// Touches every line overlapped by [address, address + size)
+		void Access(const void *address, size_t size = 1);
+
+		void Reset();
+
+		uint64_t GetAccesses() const { return mAccesses; }
+
+		uint64_t GetMisses() const { return mMisses; }
+
+	private:
+		int mSets, mWays, mLineShift;
+		// mWays tags per set, most recently used first; 0 marks an empty way
+		std::vector<uintptr_t> mTags;
+		uint64_t mAccesses = 0, mMisses = 0;
+	};
+}
+
+#endif
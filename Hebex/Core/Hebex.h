@@ -29,17 +29,23 @@ typedef unsigned __int64 uint64_t;
 #include <string>
 #include <vector>
 #include <list>
+#include <memory>
 #include <algorithm>
 #include <cinttypes>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 
-#include <malloc.h>
 #include <stdint.h>
 #include <float.h>
-#include <intrin.h>
 #include <string.h>
+#include <stdlib.h>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#include <intrin.h>
+#else
+#include <alloca.h>
+#endif
 
 #ifndef L1_CACHE_LINE_SIZE
 #define L1_CACHE_LINE_SIZE 64
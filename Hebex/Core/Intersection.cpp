@@ -0,0 +1,42 @@
+#include "Intersection.h"
+#include "Ray.h"
+#include "Transform.h"
+
+namespace Hebex
+{
+	void Intersection::ComputeDifferentials(const RayDifferential &ray, IntersectionDifferentials *d) const {
+		*d = IntersectionDifferentials();
+		if (!ray.hasDifferentials) return;
+
+		// Intersect the offset rays with the tangent plane
+		Vec3f n = mNormal;
+		float plane = Dot(n, Vec3f(mPosition.x, mPosition.y, mPosition.z));
+		float tx = -(Dot(n, Vec3f(ray.rxOrigin.x, ray.rxOrigin.y, ray.rxOrigin.z)) - plane) / Dot(n, ray.rxDirection);
+		float ty = -(Dot(n, Vec3f(ray.ryOrigin.x, ray.ryOrigin.y, ray.ryOrigin.z)) - plane) / Dot(n, ray.ryDirection);
+		if (std::isinf(tx) || std::isnan(tx) || std::isinf(ty) || std::isnan(ty)) return;
+		Point3f px = ray.rxOrigin + tx * ray.rxDirection;
+		Point3f py = ray.ryOrigin + ty * ray.ryDirection;
+		d->dpdx = px - mPosition;
+		d->dpdy = py - mPosition;
+
+		// Solve for (du, dv) in the two dimensions the normal projects least onto
+		int dim[2];
+		if (std::abs(n.x) > std::abs(n.y) && std::abs(n.x) > std::abs(n.z)) {
+			dim[0] = 1;
+			dim[1] = 2;
+		}
+		else if (std::abs(n.y) > std::abs(n.z)) {
+			dim[0] = 0;
+			dim[1] = 2;
+		}
+		else {
+			dim[0] = 0;
+			dim[1] = 1;
+		}
+		float A[2][2] = { { mDpdu[dim[0]], mDpdv[dim[0]] }, { mDpdu[dim[1]], mDpdv[dim[1]] } };
+		float Bx[2] = { px[dim[0]] - mPosition[dim[0]], px[dim[1]] - mPosition[dim[1]] };
+		float By[2] = { py[dim[0]] - mPosition[dim[0]], py[dim[1]] - mPosition[dim[1]] };
+		if (!SolveLinearSystem2x2(A, Bx, &d->dudx, &d->dvdx)) d->dudx = d->dvdx = 0.f;
+		if (!SolveLinearSystem2x2(A, By, &d->dudy, &d->dvdy)) d->dudy = d->dvdy = 0.f;
+	}
+}
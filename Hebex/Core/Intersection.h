@@ -6,6 +6,13 @@
 
 namespace Hebex
 {
+	// Screen-space derivatives of a hit, for texture filtering. Computed on
+	// demand, since most hits never need them.
+	struct IntersectionDifferentials {
+		Vec3f dpdx, dpdy;
+		float dudx = 0.f, dvdx = 0.f, dudy = 0.f, dvdy = 0.f;
+	};
+
 	class Intersection {
 	public:
 
@@ -16,17 +23,45 @@ namespace Hebex
 
 		}
 
+		// Derivatives from the offset rays of a camera ray; all zero if the
+		// ray has no differentials
+		void ComputeDifferentials(const RayDifferential &ray, IntersectionDifferentials *d) const;
+
 		Point3f mPosition;
 		Vec3f mNormal;
 		Vec2f mUV;
 		Vec3f mDpdu, mDpdv;
 		Vec3f mDndu, mDndv;
-		mutable Vec3f mDpdx, mDpdy;
-		mutable float mDudx, mDvdx, mDudy, mDvdy;
 
 		BSDF *mBSDF = nullptr;
 		BSSRDF *mBSSRDF = nullptr;
 	};
+
+	const uint32_t InvalidHitId = 0xffffffff;
+
+	// Compact record of a hit, written during traversal. The full Intersection
+	// is rebuilt from it and the ray, by the aggregate that produced it, only
+	// for the hit that is finally kept.
+	struct SurfaceHit {
+		// Called by aggregates on every accepted hit: the innermost one names
+		// the primitive, the one above it the instance
+		void RecordIndex(uint32_t index) {
+			if (primId == InvalidHitId)
+				primId = index;
+			else {
+				HEBEX_ASSERT(instanceId == InvalidHitId);
+				instanceId = index;
+			}
+		}
+
+		float t;
+		float u, v;           // shape specific, barycentrics b1 and b2 for triangles
+		uint32_t elementId;   // shape specific, the triangle of a mesh
+		uint32_t primId;      // in the innermost aggregate
+		uint32_t instanceId;  // in the aggregate above it
+	};
+
+	static_assert(sizeof(SurfaceHit) <= 32, "SurfaceHit should stay within half a cache line");
 }
 
-#endif
\ No newline at end of file
+#endif
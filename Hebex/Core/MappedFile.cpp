@@ -0,0 +1,70 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Hebex
+{
+#if defined(_WIN32)
+	MappedFile::MappedFile(const std::string &filename) {
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) {
+			CloseHandle(file);
+			return;
+		}
+		void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return;
+		}
+		mFile = file;
+		mMapping = mapping;
+		mData = (const char *)data;
+		mSize = (size_t)size.QuadPart;
+	}
+
+	MappedFile::~MappedFile() {
+		if (mData) UnmapViewOfFile(mData);
+		if (mMapping) CloseHandle(mMapping);
+		if (mFile) CloseHandle(mFile);
+	}
+#else
+	MappedFile::MappedFile(const std::string &filename) {
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			close(fd);
+			return;
+		}
+		void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// The mapping keeps the file referenced
+		close(fd);
+		if (data == MAP_FAILED) return;
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+		mData = (const char *)data;
+		mSize = (size_t)st.st_size;
+	}
+
+	MappedFile::~MappedFile() {
+		if (mData) munmap((void *)mData, mSize);
+	}
+#endif
+}
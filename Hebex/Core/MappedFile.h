@@ -0,0 +1,34 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "Hebex.h"
+
+namespace Hebex
+{
+	// Read-only memory mapping of a whole file. Pages are faulted in on first
+	// touch, so threads parsing separate ranges read the file concurrently.
+	class MappedFile {
+	public:
+		MappedFile(const std::string &filename);
+
+		~MappedFile();
+
+		bool IsOpen() const { return mData != nullptr; }
+
+		const char *Data() const { return mData; }
+
+		size_t Size() const { return mSize; }
+
+	private:
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		const char *mData = nullptr;
+		size_t mSize = 0;
+#if defined(_WIN32)
+		void *mFile = nullptr, *mMapping = nullptr;
+#endif
+	};
+}
+
+#endif
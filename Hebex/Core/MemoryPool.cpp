@@ -1,13 +1,298 @@
 #include "MemoryPool.h"
+#include "ThreadLocal.h"
+#include "Parallel.h"
+#include "Simd.h"
+#include <atomic>
+#include <mutex>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace Hebex 
 {
-	void* AllocAligned(size_t size) {
+	static const size_t HugePageSize = size_t(2) << 20;
+
+	static std::atomic<HugePages> sHugePages(HugePages::None);
+
+	// Precedes every block, one cache line long so the block stays aligned
+	struct alignas(L1_CACHE_LINE_SIZE) AllocHeader {
+		void *base;      // start of the heap block or mapping
+		size_t mapSize;  // 0 for heap blocks
+	};
+
+	static inline size_t RoundUp(size_t size, size_t align) {
+		return (size + align - 1) / align * align;
+	}
+
+#if defined(_WIN32)
+	static void *MapPages(size_t size, HugePages mode, size_t *mapSize) {
+		if (mode == HugePages::Explicit) {
+			// Needs SeLockMemoryPrivilege; large pages are committed right away
+			size_t largePage = GetLargePageMinimum();
+			if (largePage) {
+				*mapSize = RoundUp(size, largePage);
+				void *ptr = VirtualAlloc(nullptr, *mapSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+				if (ptr) return ptr;
+			}
+		}
+		*mapSize = size;
+		return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+
+	static void UnmapPages(void *ptr, size_t) {
+		VirtualFree(ptr, 0, MEM_RELEASE);
+	}
+
+	static void *AllocHeap(size_t size) {
 		return _aligned_malloc(size, L1_CACHE_LINE_SIZE);
 	}
 
+	static void FreeHeap(void *ptr) {
+		_aligned_free(ptr);
+	}
+#else
+	static void *MapPages(size_t size, HugePages mode, size_t *mapSize) {
+		const int prot = PROT_READ | PROT_WRITE;
+		const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB)
+		if (mode == HugePages::Explicit) {
+			// Fails unless huge pages were reserved (vm.nr_hugepages)
+			*mapSize = RoundUp(size, HugePageSize);
+			void *ptr = mmap(nullptr, *mapSize, prot, flags | MAP_HUGETLB, -1, 0);
+			if (ptr != MAP_FAILED) return ptr;
+		}
+#endif
+		*mapSize = RoundUp(size, sysconf(_SC_PAGESIZE));
+		if (mode == HugePages::None) {
+			void *ptr = mmap(nullptr, *mapSize, prot, flags, -1, 0);
+			return ptr == MAP_FAILED ? nullptr : ptr;
+		}
+
+		// Over-map and trim so the mapping starts on a huge page boundary,
+		// otherwise its first and last partial huge pages stay small
+		size_t padded = *mapSize + HugePageSize;
+		void *ptr = mmap(nullptr, padded, prot, flags, -1, 0);
+		if (ptr == MAP_FAILED) return nullptr;
+		uint8_t *start = (uint8_t *)ptr;
+		uint8_t *aligned = (uint8_t *)RoundUp((uintptr_t)start, HugePageSize);
+		if (aligned > start) munmap(start, aligned - start);
+		size_t tail = (start + padded) - (aligned + *mapSize);
+		if (tail) munmap(aligned + *mapSize, tail);
+#if defined(MADV_HUGEPAGE)
+		madvise(aligned, *mapSize, MADV_HUGEPAGE);
+#endif
+		return aligned;
+	}
+
+	static void UnmapPages(void *ptr, size_t size) {
+		munmap(ptr, size);
+	}
+
+	static void *AllocHeap(size_t size) {
+		void *ptr;
+		return posix_memalign(&ptr, L1_CACHE_LINE_SIZE, size) ? nullptr : ptr;
+	}
+
+	static void FreeHeap(void *ptr) {
+		free(ptr);
+	}
+#endif
+
+	void* AllocAligned(size_t size) {
+		size_t total = size + sizeof(AllocHeader);
+		void *base;
+		size_t mapSize = 0;
+		if (size >= LargeAllocSize)
+			base = MapPages(total, sHugePages.load(std::memory_order_relaxed), &mapSize);
+		else
+			base = AllocHeap(total);
+		if (!base) return nullptr;
+
+		AllocHeader *header = (AllocHeader *)base;
+		header->base = base;
+		header->mapSize = mapSize;
+		return header + 1;
+	}
+
 	void FreeAligned(void *ptr) {
 		if (!ptr) return;
-		_aligned_free(ptr);
+		AllocHeader *header = (AllocHeader *)ptr - 1;
+		if (header->mapSize) UnmapPages(header->base, header->mapSize);
+		else FreeHeap(header->base);
+	}
+
+	void SetHugePages(HugePages mode) {
+		sHugePages.store(mode, std::memory_order_relaxed);
+	}
+
+	HugePages GetHugePages() {
+		return sHugePages.load(std::memory_order_relaxed);
+	}
+
+	void FirstTouch(void *ptr, size_t size) {
+		if (size < LargeAllocSize) return;
+		// One huge page per work item, so none is split between threads
+		uintptr_t begin = (uintptr_t)ptr, end = begin + size;
+		uintptr_t firstPage = begin / HugePageSize * HugePageSize;
+		int64_t nPages = (end - firstPage + HugePageSize - 1) / HugePageSize;
+		ParallelFor([&](int64_t page) {
+			uintptr_t pageBegin = std::max(begin, firstPage + page * HugePageSize);
+			uintptr_t pageEnd = std::min(end, firstPage + (page + 1) * HugePageSize);
+			memset((void *)pageBegin, 0, pageEnd - pageBegin);
+		}, nPages);
+	}
+
+	// Live pools and the counters of destroyed ones. Never freed, since
+	// static pools may be destroyed after any other static.
+	struct PoolRegistry {
+		std::mutex mutex;
+		std::vector<const MemoryPool *> pools;
+		MemoryPoolStats retired;
+	};
+
+	static PoolRegistry &Registry() {
+		static PoolRegistry *registry = new PoolRegistry;
+		return *registry;
+	}
+
+	MemoryPoolStats &MemoryPoolStats::operator+=(const MemoryPoolStats &s) {
+		nPools += s.nPools;
+		nBlocks += s.nBlocks;
+		totalAllocated += s.totalAllocated;
+		bytesInUse += s.bytesInUse;
+		peakBytesInUse += s.peakBytesInUse;
+		maxPeakBytesInUse = std::max(maxPeakBytesInUse, s.maxPeakBytesInUse);
+		allocs += s.allocs;
+		bytesRequested += s.bytesRequested;
+		paddingBytes += s.paddingBytes;
+		blockTailBytes += s.blockTailBytes;
+		resets += s.resets;
+		return *this;
+	}
+
+	std::ostream &operator<<(std::ostream &os, const MemoryPoolStats &s) {
+		os << "pools " << s.nPools << ", blocks " << s.nBlocks << ", allocated " << s.totalAllocated
+			<< " bytes, in use " << s.bytesInUse << ", peak " << s.peakBytesInUse
+			<< " (largest pool " << s.maxPeakBytesInUse << ")\n";
+		os << "allocs " << s.allocs << ", requested " << s.bytesRequested << " bytes, padding "
+			<< s.paddingBytes << ", block tails " << s.blockTailBytes << ", resets " << s.resets;
+		return os;
+	}
+
+	MemoryPool::MemoryPool(size_t blockSize) : mBlockSize(blockSize) {
+		PoolRegistry &registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.pools.push_back(this);
+	}
+
+	MemoryPool::~MemoryPool() {
+		FreeAligned(mCurrentBlock);
+		for (auto &block : mUsedBlocks) FreeAligned(block.second);
+		for (auto &sizeClass : mFreeBlocks)
+			for (auto &block : sizeClass) FreeAligned(block.second);
+
+		MemoryPoolStats stats = GetStats();
+		stats.nPools = 0;
+		stats.nBlocks = stats.totalAllocated = stats.bytesInUse = 0;
+		PoolRegistry &registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.pools.erase(std::find(registry.pools.begin(), registry.pools.end(), this));
+		registry.retired += stats;
+	}
+
+	// Smallest k with (mBlockSize << k) >= nBytes
+	static int SizeClassFor(size_t nBytes, size_t blockSize) {
+		size_t nBlocks = (nBytes + blockSize - 1) / blockSize;
+		if (nBlocks <= 1) return 0;
+		return Log2Int(uint32_t(nBlocks - 1)) + 1;
+	}
+
+	void MemoryPool::NextBlock(size_t nBytes) {
+		if (mCurrentBlock) {
+			mBlockTailBytes += mCurrentAllocSize - mCurrentBlockOffset;
+			mUsedBlocks.push_back(Block(mCurrentAllocSize, mCurrentBlock));
+			mCurrentBlock = nullptr;
+			mCurrentAllocSize = 0;
+		}
+
+		int sizeClass = SizeClassFor(nBytes, mBlockSize);
+		HEBEX_ASSERT(sizeClass < NumSizeClasses);
+		uint32_t fitting = mFreeClassMask & ~((1u << sizeClass) - 1);
+		if (fitting) {
+			int k = CountTrailingZeros(fitting);
+			Block block = mFreeBlocks[k].back();
+			mFreeBlocks[k].pop_back();
+			if (mFreeBlocks[k].empty()) mFreeClassMask &= ~(1u << k);
+			mCurrentAllocSize = block.first;
+			mCurrentBlock = block.second;
+		}
+		else {
+			mCurrentAllocSize = mBlockSize << sizeClass;
+			mCurrentBlock = AllocAligned<uint8_t>(mCurrentAllocSize);
+			++mBlocks;
+			mTotalAllocated += mCurrentAllocSize;
+		}
+		mCurrentBlockOffset = 0;
+	}
+
+	void MemoryPool::Reset() {
+		mCurrentBlockOffset = 0;
+		for (const Block &block : mUsedBlocks) {
+			int k = Log2Int(uint32_t(block.first / mBlockSize));
+			mFreeBlocks[k].push_back(block);
+			mFreeClassMask |= 1u << k;
+		}
+		mUsedBlocks.clear();
+		mBytesInUse = 0;
+		++mResets;
+	}
+
+	MemoryPoolStats MemoryPool::GetStats() const {
+		MemoryPoolStats stats;
+		stats.nPools = 1;
+		stats.nBlocks = mBlocks;
+		stats.totalAllocated = mTotalAllocated;
+		stats.bytesInUse = mBytesInUse;
+		stats.peakBytesInUse = stats.maxPeakBytesInUse = mPeakBytesInUse;
+		stats.allocs = mAllocs;
+		stats.bytesRequested = mBytesRequested;
+		stats.paddingBytes = mPaddingBytes;
+		stats.blockTailBytes = mBlockTailBytes;
+		stats.resets = mResets;
+		return stats;
+	}
+
+	MemoryPoolStats GetMemoryPoolStats() {
+		PoolRegistry &registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		MemoryPoolStats stats = registry.retired;
+		for (const MemoryPool *pool : registry.pools)
+			stats += pool->GetStats();
+		return stats;
+	}
+
+	static ThreadLocal<MemoryPool> &ThreadMemoryPools() {
+		static ThreadLocal<MemoryPool> pools;
+		return pools;
+	}
+
+	MemoryPool &ThreadMemoryPool() {
+		return ThreadMemoryPools().Get();
+	}
+
+	void ResetThreadMemoryPools() {
+		ThreadMemoryPools().ForAll([](MemoryPool &pool) { pool.Reset(); });
+	}
+
+	MemoryPoolStats GetThreadMemoryPoolStats() {
+		MemoryPoolStats stats;
+		ThreadMemoryPools().ForAll([&stats](const MemoryPool &pool) { stats += pool.GetStats(); });
+		return stats;
 	}
 }
\ No newline at end of file
@@ -8,6 +8,12 @@ namespace Hebex
 {
 	#define ARENA_ALLOC(arena, Type) new ((arena).Alloc(sizeof(Type))) Type
 
+	// Blocks of at least this size are mapped straight from the OS, may use
+	// huge pages, and are not committed until first written, so each page
+	// lands on the NUMA node of the thread that first touches it
+	constexpr size_t LargeAllocSize = size_t(2) << 20;
+
+	// Cache line aligned; portable replacement for _aligned_malloc
 	void* AllocAligned(size_t size);
 
 	template<typename T>
@@ -17,45 +23,67 @@ namespace Hebex
 
 	void FreeAligned(void*);
 
+	// Page size used for large blocks
+	enum class HugePages {
+		None,
+		Transparent,  // madvise(MADV_HUGEPAGE) on Linux, regular pages elsewhere
+		Explicit      // MAP_HUGETLB or MEM_LARGE_PAGES, Transparent if none are available
+	};
+
+	// Affects later allocations only. None by default: where the kernel
+	// defragments on fault, huge pages can make first touch far slower,
+	// which only pays off for long-lived, randomly accessed blocks.
+	void SetHugePages(HugePages mode);
+
+	HugePages GetHugePages();
+
+	// Zeroes a large block from all pool threads, spreading its pages over
+	// the workers' NUMA nodes instead of the allocating thread's; blocks
+	// shared by every worker (BVH nodes, vertex arrays) should be touched
+	// this way before being filled serially. No-op for small blocks.
+	void FirstTouch(void *ptr, size_t size);
+
+	// Counters of one pool, or totals over several. Lifetime counters
+	// survive Reset; peaks are high-water marks of bytesInUse.
+	struct MemoryPoolStats {
+		int nPools = 0;
+		size_t nBlocks = 0;
+		size_t totalAllocated = 0;     // bytes held in blocks, used or not
+		size_t bytesInUse = 0;         // handed out since the last Reset
+		size_t peakBytesInUse = 0;     // sum of the pools' peaks
+		size_t maxPeakBytesInUse = 0;  // largest peak of a single pool
+		uint64_t allocs = 0;           // lifetime
+		size_t bytesRequested = 0;     // lifetime, as passed to Alloc
+		size_t paddingBytes = 0;       // lifetime, lost to alignment
+		size_t blockTailBytes = 0;     // lifetime, left unused at block ends
+		uint64_t resets = 0;
+
+		MemoryPoolStats &operator+=(const MemoryPoolStats &s);
+	};
+
+	std::ostream &operator<<(std::ostream &os, const MemoryPoolStats &s);
+
 	class alignas(L1_CACHE_LINE_SIZE) MemoryPool{
 	public:
-		MemoryPool(size_t blockSize = 262144) : mBlockSize(blockSize) {}
+		MemoryPool(size_t blockSize = 262144);
 
-		~MemoryPool() {
-			FreeAligned(mCurrentBlock);
-			for (auto &block : mUsedBlocks) FreeAligned(block.second);
-			for (auto &block : mAvailableBlocks) FreeAligned(block.second);
-		}
+		~MemoryPool();
 
 		void* Alloc(size_t nBytes) {
 			const int align = alignof(std::max_align_t);
 			static_assert(IsPowerOf2(align), "Minium alignment must be a power of tow");
 			
-			nBytes = (nBytes + align - 1) & (~(align - 1));
-			if (mCurrentBlockOffset + nBytes > mCurrentAllocSize) {
-				if (mCurrentBlock) {
-					mUsedBlocks.push_back(std::make_pair(mCurrentAllocSize, mCurrentBlock));
-					mCurrentBlock = nullptr;
-					mCurrentAllocSize = 0;
-				}
-
-				for (auto iter = mAvailableBlocks.begin(); iter != mAvailableBlocks.end(); ++iter) {
-					if (iter->first >= nBytes) {
-						mCurrentAllocSize = iter->first;
-						mCurrentBlock = iter->second;
-						mAvailableBlocks.erase(iter);
-						break;
-					}
-				}
-				if (!mCurrentBlock) {
-					mCurrentAllocSize = std::max(nBytes, mBlockSize);
-					mCurrentBlock = AllocAligned<uint8_t>(mCurrentAllocSize);
-				}
-				mCurrentBlockOffset = 0;
-			}
+			size_t rounded = (nBytes + align - 1) & (~(align - 1));
+			if (mCurrentBlockOffset + rounded > mCurrentAllocSize)
+				NextBlock(rounded);
 
 			void *ret = mCurrentBlock + mCurrentBlockOffset;
-			mCurrentBlockOffset += nBytes;
+			mCurrentBlockOffset += rounded;
+			mBytesInUse += rounded;
+			mPeakBytesInUse = std::max(mPeakBytesInUse, mBytesInUse);
+			++mAllocs;
+			mBytesRequested += nBytes;
+			mPaddingBytes += rounded - nBytes;
 
 			return ret;
 		}
@@ -68,27 +96,58 @@ namespace Hebex
 			return ret;
 		}
 
-		void Reset() {
-			mCurrentBlockOffset = 0;
-			mAvailableBlocks.splice(mAvailableBlocks.begin(), mUsedBlocks);
-		}
+		// Frees everything at once; the blocks are kept for reuse
+		void Reset();
 
-		size_t TotalAllocated() const {
-			size_t total = mCurrentAllocSize;
-			for (const auto &iter : mUsedBlocks) total += iter.first;
-			for (const auto &iter : mAvailableBlocks) total += iter.first;
-			return total;
-		}
+		size_t TotalAllocated() const { return mTotalAllocated; }
+
+		// Bytes handed out since the last Reset
+		size_t BytesInUse() const { return mBytesInUse; }
+
+		size_t PeakBytesInUse() const { return mPeakBytesInUse; }
+
+		uint64_t GetResets() const { return mResets; }
+
+		MemoryPoolStats GetStats() const;
 
 	private:
 		MemoryPool(const MemoryPool &) = delete;
 		MemoryPool &operator=(const MemoryPool &) = delete;
+
+		// Makes a block of at least nBytes current, reusing a free one if possible
+		void NextBlock(size_t nBytes);
+
+		// Free blocks are bucketed by size: class k holds blocks of at least
+		// mBlockSize << k bytes, and larger blocks are allocated at exactly
+		// that size, so the smallest fitting class is found from a bit mask
+		static const int NumSizeClasses = 32;
+		typedef std::pair<size_t, uint8_t *> Block;
+
 		const size_t mBlockSize;
 		size_t mCurrentBlockOffset = 0, mCurrentAllocSize = 0;
 		uint8_t *mCurrentBlock = nullptr;
-		std::list<std::pair<size_t, uint8_t *>> mUsedBlocks, mAvailableBlocks;
+		std::vector<Block> mUsedBlocks;
+		std::vector<Block> mFreeBlocks[NumSizeClasses];
+		uint32_t mFreeClassMask = 0;
+		size_t mBlocks = 0, mTotalAllocated = 0;
+		size_t mBytesInUse = 0, mPeakBytesInUse = 0;
+		uint64_t mAllocs = 0, mResets = 0;
+		size_t mBytesRequested = 0, mPaddingBytes = 0, mBlockTailBytes = 0;
 	};
-	
+
+	// Arena of the calling pool thread, for short-lived allocations on the
+	// shading path such as BSDFs. Reset it after every sample or tile; its
+	// blocks are reused rather than returned to the heap.
+	MemoryPool &ThreadMemoryPool();
+
+	// Resets every thread's arena. Must not race with their use.
+	void ResetThreadMemoryPools();
+
+	MemoryPoolStats GetThreadMemoryPoolStats();
+
+	// Totals over every live pool, plus the lifetime counters and peaks of
+	// pools already destroyed. Must not race with the pools' use.
+	MemoryPoolStats GetMemoryPoolStats();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include "Hebex.h"
+#include "MemoryPool.h"
+#include "ThreadLocal.h"
+#include <mutex>
+
+namespace Hebex
+{
+	// Recycles objects of one type, for short-lived objects that are freed
+	// one at a time. Each pool thread keeps its own free list and trades
+	// whole batches with a shared depot under a lock, so an object may be
+	// freed by another thread than the one that allocated it. Once warmed
+	// up the footprint stays flat and the global allocator is not called.
+	// Slots are padded to whole cache lines, so objects used by different
+	// threads never share one.
+	template <typename T>
+	class ObjectPool {
+	public:
+		explicit ObjectPool(int batchSize = 64) : mBatchSize(batchSize) {}
+
+		// Objects still allocated are not destroyed
+		~ObjectPool() {
+			for (uint8_t *slab : mSlabs) FreeAligned(slab);
+		}
+
+		template <typename... Args>
+		T *Alloc(Args &&... args) {
+			Cache &cache = mCaches.Get();
+			if (!cache.head) Refill(cache);
+			FreeNode *node = cache.head;
+			cache.head = node->next;
+			--cache.count;
+			return new (node) T(std::forward<Args>(args)...);
+		}
+
+		void Free(T *obj) {
+			if (!obj) return;
+			obj->~T();
+			Cache &cache = mCaches.Get();
+			FreeNode *node = (FreeNode *)obj;
+			node->next = cache.head;
+			cache.head = node;
+			if (++cache.count == 2 * mBatchSize) Release(cache);
+		}
+
+		// Objects backed by memory, allocated or free
+		size_t Capacity() const {
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mSlabs.size() * mBatchSize;
+		}
+
+		size_t TotalAllocated() const {
+			return Capacity() * SlotSize;
+		}
+
+	private:
+		ObjectPool(const ObjectPool &) = delete;
+		ObjectPool &operator=(const ObjectPool &) = delete;
+
+		struct FreeNode {
+			FreeNode *next;
+			FreeNode *nextBatch;  // depot link, set on the first node of a batch
+		};
+
+		struct alignas(L1_CACHE_LINE_SIZE) Cache {
+			FreeNode *head = nullptr;
+			int count = 0;
+		};
+
+		static constexpr size_t SlotSize = (std::max(sizeof(T), sizeof(FreeNode)) +
+			L1_CACHE_LINE_SIZE - 1) / L1_CACHE_LINE_SIZE * L1_CACHE_LINE_SIZE;
+		static_assert(alignof(T) <= L1_CACHE_LINE_SIZE, "Objects must fit cache line aligned slots");
+
+		// Takes a batch from the depot, or carves one out of a new slab
+		void Refill(Cache &cache) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mDepot) {
+				cache.head = mDepot;
+				mDepot = mDepot->nextBatch;
+			}
+			else {
+				uint8_t *slab = AllocAligned<uint8_t>(SlotSize * mBatchSize);
+				mSlabs.push_back(slab);
+				for (int i = 0; i < mBatchSize; ++i)
+					((FreeNode *)(slab + i * SlotSize))->next =
+						i + 1 < mBatchSize ? (FreeNode *)(slab + (i + 1) * SlotSize) : nullptr;
+				cache.head = (FreeNode *)slab;
+			}
+			cache.count = mBatchSize;
+		}
+
+		// Hands the first batch of a full cache back to the depot
+		void Release(Cache &cache) {
+			FreeNode *batch = cache.head, *last = batch;
+			for (int i = 1; i < mBatchSize; ++i) last = last->next;
+			cache.head = last->next;
+			cache.count -= mBatchSize;
+			last->next = nullptr;
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			batch->nextBatch = mDepot;
+			mDepot = batch;
+		}
+
+		const int mBatchSize;
+		ThreadLocal<Cache> mCaches;
+		mutable std::mutex mMutex;
+		FreeNode *mDepot = nullptr;
+		std::vector<uint8_t *> mSlabs;
+	};
+}
+
+#endif
@@ -0,0 +1,160 @@
+#include "Parallel.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+namespace Hebex
+{
+	thread_local int ThreadIndex = -1;
+
+	// Indices of threads that are not pool workers
+	struct ThreadIndexRegistry {
+		std::mutex mutex;
+		std::vector<int> freeIndices{ 0 };
+		int nextIndex = -1;
+	};
+
+	static ThreadIndexRegistry &IndexRegistry() {
+		static ThreadIndexRegistry *registry = new ThreadIndexRegistry;
+		return *registry;
+	}
+
+	// Hands the index of a registered thread back when the thread exits
+	struct ThreadIndexOwner {
+		~ThreadIndexOwner() {
+			if (index < 0) return;
+			ThreadIndexRegistry &registry = IndexRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.freeIndices.push_back(index);
+		}
+
+		int index = -1;
+	};
+
+	class ParallelForLoop {
+	public:
+		ParallelForLoop(const std::function<void(int64_t)> &func, int64_t maxIndex, int chunkSize) :
+			func(func), maxIndex(maxIndex), chunkSize(chunkSize) {
+		}
+
+		bool Finished() const {
+			return nextIndex >= maxIndex && activeWorkers == 0;
+		}
+
+		const std::function<void(int64_t)> &func;
+		const int64_t maxIndex;
+		const int chunkSize;
+		int64_t nextIndex = 0;
+		int activeWorkers = 0;
+		ParallelForLoop *next = nullptr;
+	};
+
+	static std::vector<std::thread> threads;
+	static bool shutdownThreads = false;
+	static ParallelForLoop *workList = nullptr;
+	static std::mutex workListMutex;
+	static std::condition_variable workListCondition;
+	static std::once_flag initFlag;
+
+	// Takes the next chunk of the loop at the head of the work list and runs it
+	// with the lock released; returns with the lock held again
+	static void RunChunk(std::unique_lock<std::mutex> &lock) {
+		ParallelForLoop &loop = *workList;
+		int64_t indexStart = loop.nextIndex;
+		int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
+		loop.nextIndex = indexEnd;
+		if (loop.nextIndex == loop.maxIndex) workList = loop.next;
+		loop.activeWorkers++;
+
+		lock.unlock();
+		for (int64_t index = indexStart; index < indexEnd; ++index)
+			loop.func(index);
+		lock.lock();
+
+		loop.activeWorkers--;
+		if (loop.Finished()) workListCondition.notify_all();
+	}
+
+	static void WorkerThreadFunc(int threadIndex) {
+		ThreadIndex = threadIndex;
+		std::unique_lock<std::mutex> lock(workListMutex);
+		while (!shutdownThreads) {
+			if (!workList)
+				workListCondition.wait(lock);
+			else
+				RunChunk(lock);
+		}
+	}
+
+	int NumSystemCores() {
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	void ParallelInit(int nThreads) {
+		std::call_once(initFlag, [nThreads]() {
+			int n = nThreads > 0 ? nThreads : NumSystemCores();
+			for (int i = 0; i < n - 1; ++i)
+				threads.push_back(std::thread(WorkerThreadFunc, i + 1));
+		});
+	}
+
+	void ParallelCleanup() {
+		if (threads.empty()) return;
+		{
+			std::lock_guard<std::mutex> lock(workListMutex);
+			shutdownThreads = true;
+			workListCondition.notify_all();
+		}
+		for (std::thread &thread : threads) thread.join();
+		threads.clear();
+		shutdownThreads = false;
+	}
+
+	int MaxThreadIndex() {
+		ParallelInit();
+		return 1 + threads.size();
+	}
+
+	int RegisterThreadIndex() {
+		static thread_local ThreadIndexOwner owner;
+		int maxThreadIndex = MaxThreadIndex();
+		ThreadIndexRegistry &registry = IndexRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		if (registry.nextIndex < 0) registry.nextIndex = maxThreadIndex;
+		if (registry.freeIndices.empty())
+			ThreadIndex = registry.nextIndex++;
+		else {
+			// Lowest free index first, which keeps ThreadLocal tables dense
+			auto lowest = std::min_element(registry.freeIndices.begin(), registry.freeIndices.end());
+			ThreadIndex = *lowest;
+			registry.freeIndices.erase(lowest);
+		}
+		owner.index = ThreadIndex;
+		return ThreadIndex;
+	}
+
+	void ParallelFor(const std::function<void(int64_t)> &func, int64_t count, int chunkSize) {
+		ParallelInit();
+		// Run small loops and single-threaded configurations inline
+		if (threads.empty() || count < chunkSize) {
+			for (int64_t i = 0; i < count; ++i) func(i);
+			return;
+		}
+
+		ParallelForLoop loop(func, count, chunkSize);
+		std::unique_lock<std::mutex> lock(workListMutex);
+		loop.next = workList;
+		workList = &loop;
+		workListCondition.notify_all();
+
+		// Help with the work until this loop is done; chunks of other loops
+		// queued in front of it (nested calls) are run as well
+		while (!loop.Finished()) {
+			if (!workList)
+				workListCondition.wait(lock);
+			else
+				RunChunk(lock);
+		}
+	}
+}
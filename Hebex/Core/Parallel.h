@@ -0,0 +1,39 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "Hebex.h"
+#include <functional>
+#include <atomic>
+
+namespace Hebex
+{
+	// 1..MaxThreadIndex() - 1 on pool workers; -1 on any other thread until
+	// GetThreadIndex registers it
+	extern thread_local int ThreadIndex;
+
+	// Gives the calling thread, which is not a pool worker, an index no live
+	// thread holds: 0 for the first one (normally the main thread), then
+	// MaxThreadIndex() and up. The index is released when the thread exits.
+	int RegisterThreadIndex();
+
+	// Index of the calling thread, unique among live threads
+	inline int GetThreadIndex() {
+		return ThreadIndex >= 0 ? ThreadIndex : RegisterThreadIndex();
+	}
+
+	// Starts nThreads - 1 workers (the caller of ParallelFor is the last one);
+	// nThreads <= 0 uses every core. Called lazily by ParallelFor if needed.
+	void ParallelInit(int nThreads = 0);
+
+	void ParallelCleanup();
+
+	int NumSystemCores();
+
+	int MaxThreadIndex();
+
+	// Runs func(i) for i in [0, count), handing out chunkSize indices at a
+	// time to the pool and the calling thread. Nested calls are allowed.
+	void ParallelFor(const std::function<void(int64_t)> &func, int64_t count, int chunkSize = 1);
+}
+
+#endif
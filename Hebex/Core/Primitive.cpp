@@ -0,0 +1,112 @@
+#include "Primitive.h"
+#include "Shape.h"
+#include "Ray.h"
+#include "Transform.h"
+#include "Intersection.h"
+
+namespace Hebex
+{
+	Primitive::~Primitive() { }
+
+	bool Primitive::Intersect(const Ray &ray, Intersection *isect) const {
+		SurfaceHit hit;
+		if (!IntersectHit(ray, &hit)) return false;
+		ComputeIntersection(ray, hit, isect);
+		return true;
+	}
+
+	GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape) :
+		mShape(shape) {
+	}
+
+	BBox GeometricPrimitive::WorldBound() const {
+		return mShape->WorldBound();
+	}
+
+	bool GeometricPrimitive::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		if (!mShape->IntersectHit(ray, hit)) return false;
+		hit->primId = hit->instanceId = InvalidHitId;
+		ray.tMax = hit->t;
+		return true;
+	}
+
+	void GeometricPrimitive::ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		mShape->ComputeSurfaceInteraction(ray, hit, isect);
+	}
+
+	bool GeometricPrimitive::IntersectP(const Ray &ray) const {
+		return mShape->IntersectP(ray);
+	}
+
+	TransformedPrimitive::TransformedPrimitive(const std::shared_ptr<Primitive> &primitive,
+		const AffineTransform *p2w, const AffineTransform *w2p) :
+		PrimitiveToWorld(p2w), WorldToPrimitive(w2p), mPrimitive(primitive), mNormalToWorld(*p2w) {
+	}
+
+	BBox TransformedPrimitive::WorldBound() const {
+		return (*PrimitiveToWorld)(mPrimitive->WorldBound());
+	}
+
+	bool TransformedPrimitive::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		// The direction is not renormalized, so t is the same in both spaces
+		Ray r = (*WorldToPrimitive)(ray);
+		if (!mPrimitive->IntersectHit(r, hit)) return false;
+		ray.tMax = r.tMax;
+		return true;
+	}
+
+	void TransformedPrimitive::ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		mPrimitive->ComputeIntersection((*WorldToPrimitive)(ray), hit, isect);
+
+		const AffineTransform &p2w = *PrimitiveToWorld;
+		isect->mPosition = p2w(isect->mPosition);
+		isect->mNormal = mNormalToWorld(isect->mNormal);
+		isect->mDpdu = p2w(isect->mDpdu);
+		isect->mDpdv = p2w(isect->mDpdv);
+		isect->mDndu = mNormalToWorld(isect->mDndu);
+		isect->mDndv = mNormalToWorld(isect->mDndv);
+	}
+
+	bool TransformedPrimitive::IntersectP(const Ray &ray) const {
+		return mPrimitive->IntersectP((*WorldToPrimitive)(ray));
+	}
+
+	AnimatedPrimitive::AnimatedPrimitive(const std::shared_ptr<Primitive> &primitive,
+		const AnimatedTransform &primitiveToWorld) :
+		PrimitiveToWorld(primitiveToWorld), mPrimitive(primitive),
+		mWorldBound(primitiveToWorld.MotionBounds(primitive->WorldBound())) {
+	}
+
+	BBox AnimatedPrimitive::WorldBound() const {
+		return mWorldBound;
+	}
+
+	bool AnimatedPrimitive::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		AffineTransform p2w;
+		PrimitiveToWorld.Interpolate(ray.mTime, &p2w);
+		Ray r = Inverse(p2w)(ray);
+		if (!mPrimitive->IntersectHit(r, hit)) return false;
+		ray.tMax = r.tMax;
+		return true;
+	}
+
+	void AnimatedPrimitive::ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		AffineTransform p2w;
+		PrimitiveToWorld.Interpolate(ray.mTime, &p2w);
+		mPrimitive->ComputeIntersection(Inverse(p2w)(ray), hit, isect);
+
+		NormalMatrix n2w(p2w);
+		isect->mPosition = p2w(isect->mPosition);
+		isect->mNormal = n2w(isect->mNormal);
+		isect->mDpdu = p2w(isect->mDpdu);
+		isect->mDpdv = p2w(isect->mDpdv);
+		isect->mDndu = n2w(isect->mDndu);
+		isect->mDndv = n2w(isect->mDndv);
+	}
+
+	bool AnimatedPrimitive::IntersectP(const Ray &ray) const {
+		AffineTransform p2w;
+		PrimitiveToWorld.Interpolate(ray.mTime, &p2w);
+		return mPrimitive->IntersectP(Inverse(p2w)(ray));
+	}
+}
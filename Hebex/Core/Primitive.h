@@ -0,0 +1,102 @@
+#ifndef PRIMITIVE_H
+#define PRIMITIVE_H
+
+#include "../ForwardDecl.h"
+#include "Hebex.h"
+#include "BBox.h"
+#include "Transform.h"
+
+namespace Hebex
+{
+	class Primitive {
+	public:
+		//Primitive Interface
+		virtual ~Primitive();
+
+		virtual BBox WorldBound() const = 0;
+
+		// Closest hit: on success ray.tMax is shortened to the hit distance.
+		// Only the SurfaceHit is recorded, aggregates overwrite it as closer
+		// hits are found.
+		virtual bool IntersectHit(const Ray &ray, SurfaceHit *hit) const = 0;
+
+		// Rebuilds the world-space geometry of a hit this primitive reported
+		virtual void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const = 0;
+
+		// Closest hit with its differential geometry
+		bool Intersect(const Ray &ray, Intersection *isect) const;
+
+		// Any hit: returns as soon as some hit inside [tMin, tMax] is found
+		virtual bool IntersectP(const Ray &ray) const = 0;
+	};
+
+	class GeometricPrimitive : public Primitive {
+	public:
+		GeometricPrimitive(const std::shared_ptr<Shape> &shape);
+
+		BBox WorldBound() const;
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		const std::shared_ptr<Shape> &GetShape() const { return mShape; }
+
+	private:
+		std::shared_ptr<Shape> mShape;
+	};
+
+	// Instance of a shared primitive, typically a bottom-level aggregate, placed
+	// in the world by its own transform. Any number of instances may reference
+	// the same primitive, whose geometry is stored once. Hits record one level
+	// of instancing, so the primitive must not contain instances itself.
+	class TransformedPrimitive : public Primitive {
+	public:
+		TransformedPrimitive(const std::shared_ptr<Primitive> &primitive,
+			const AffineTransform *p2w, const AffineTransform *w2p);
+
+		BBox WorldBound() const;
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		const std::shared_ptr<Primitive> &GetPrimitive() const { return mPrimitive; }
+
+		const AffineTransform *PrimitiveToWorld, *WorldToPrimitive;
+
+	private:
+		std::shared_ptr<Primitive> mPrimitive;
+		NormalMatrix mNormalToWorld;
+	};
+
+	// Instance moving over the shutter interval: each ray sees the primitive
+	// where the animated transform places it at the ray's time. The world
+	// bound covers the whole motion, so aggregates need no knowledge of time.
+	class AnimatedPrimitive : public Primitive {
+	public:
+		AnimatedPrimitive(const std::shared_ptr<Primitive> &primitive, const AnimatedTransform &primitiveToWorld);
+
+		BBox WorldBound() const;
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeIntersection(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		const std::shared_ptr<Primitive> &GetPrimitive() const { return mPrimitive; }
+
+		const AnimatedTransform PrimitiveToWorld;
+
+	private:
+		std::shared_ptr<Primitive> mPrimitive;
+		BBox mWorldBound;
+	};
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "Quaternion.h"
+#include "Transform.h"
+
+namespace Hebex
+{
+	Quaternion::Quaternion(const Transform &t) {
+		const Matrix4x4 &m = t.GetMatrix();
+		float trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+		if (trace > 0.f) {
+			float s = std::sqrt(trace + 1.f);
+			w = s / 2.f;
+			s = .5f / s;
+			v.x = (m.m[2][1] - m.m[1][2]) * s;
+			v.y = (m.m[0][2] - m.m[2][0]) * s;
+			v.z = (m.m[1][0] - m.m[0][1]) * s;
+		}
+		else {
+			// Start from the largest diagonal entry for stability
+			const int next[3] = { 1, 2, 0 };
+			float q[3];
+			int i = 0;
+			if (m.m[1][1] > m.m[0][0]) i = 1;
+			if (m.m[2][2] > m.m[i][i]) i = 2;
+			int j = next[i];
+			int k = next[j];
+			float s = std::sqrt((m.m[i][i] - (m.m[j][j] + m.m[k][k])) + 1.f);
+			q[i] = s * .5f;
+			if (s != 0.f) s = .5f / s;
+			w = (m.m[k][j] - m.m[j][k]) * s;
+			q[j] = (m.m[j][i] + m.m[i][j]) * s;
+			q[k] = (m.m[k][i] + m.m[i][k]) * s;
+			v = Vec3f(q[0], q[1], q[2]);
+		}
+	}
+
+	Transform Quaternion::ToTransform() const {
+		float xx = v.x * v.x, yy = v.y * v.y, zz = v.z * v.z;
+		float xy = v.x * v.y, xz = v.x * v.z, yz = v.y * v.z;
+		float wx = v.x * w, wy = v.y * w, wz = v.z * w;
+
+		Matrix4x4 m(1.f - 2.f * (yy + zz), 2.f * (xy - wz), 2.f * (xz + wy), 0.f,
+			2.f * (xy + wz), 1.f - 2.f * (xx + zz), 2.f * (yz - wx), 0.f,
+			2.f * (xz - wy), 2.f * (yz + wx), 1.f - 2.f * (xx + yy), 0.f,
+			0.f, 0.f, 0.f, 1.f);
+		return Transform(m, Transpose(m));
+	}
+
+	Quaternion Slerp(float t, const Quaternion &q1, const Quaternion &q2) {
+		float cosTheta = Dot(q1, q2);
+		// Nearly parallel: the arc is indistinguishable from its chord
+		if (cosTheta > .9995f)
+			return Normalize((1.f - t) * q1 + t * q2);
+
+		float theta = std::acos(Clamp(cosTheta, -1.f, 1.f));
+		float thetap = theta * t;
+		Quaternion qperp = Normalize(q2 - q1 * cosTheta);
+		return q1 * std::cos(thetap) + qperp * std::sin(thetap);
+	}
+}
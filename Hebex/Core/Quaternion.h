@@ -0,0 +1,84 @@
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+#include "../ForwardDecl.h"
+#include "Hebex.h"
+#include "Geometry.h"
+
+namespace Hebex
+{
+	// Unit quaternions represent the rotation part of animated transforms
+	struct Quaternion {
+		Quaternion() : v(0.f, 0.f, 0.f), w(1.f) {}
+
+		// Rotation part of t, which must be a pure rotation
+		explicit Quaternion(const Transform &t);
+
+		Quaternion &operator+=(const Quaternion &q) {
+			v += q.v;
+			w += q.w;
+			return *this;
+		}
+
+		Quaternion operator+(const Quaternion &q) const {
+			Quaternion ret = *this;
+			return ret += q;
+		}
+
+		Quaternion &operator-=(const Quaternion &q) {
+			v -= q.v;
+			w -= q.w;
+			return *this;
+		}
+
+		Quaternion operator-(const Quaternion &q) const {
+			Quaternion ret = *this;
+			return ret -= q;
+		}
+
+		Quaternion operator-() const {
+			Quaternion ret;
+			ret.v = -v;
+			ret.w = -w;
+			return ret;
+		}
+
+		Quaternion &operator*=(float f) {
+			v *= f;
+			w *= f;
+			return *this;
+		}
+
+		Quaternion operator*(float f) const {
+			Quaternion ret = *this;
+			return ret *= f;
+		}
+
+		Quaternion operator/(float f) const {
+			return *this * (1.f / f);
+		}
+
+		Transform ToTransform() const;
+
+		Vec3f v;
+		float w;
+	};
+
+	inline Quaternion operator*(float f, const Quaternion &q) {
+		return q * f;
+	}
+
+	inline float Dot(const Quaternion &q1, const Quaternion &q2) {
+		return Dot(q1.v, q2.v) + q1.w * q2.w;
+	}
+
+	inline Quaternion Normalize(const Quaternion &q) {
+		return q / std::sqrt(Dot(q, q));
+	}
+
+	// Constant angular velocity interpolation, along the shorter arc if
+	// Dot(q1, q2) >= 0
+	Quaternion Slerp(float t, const Quaternion &q1, const Quaternion &q2);
+}
+
+#endif
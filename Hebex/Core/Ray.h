@@ -9,22 +9,24 @@ namespace Hebex
 	class Ray {
 	public:
 
-		Ray() : tMin(0.f), tMax(INFINITY) {}
+		Ray() : tMin(0.f), tMax(INFINITY), mTime(0.f) {}
 
-		Ray(const Point3f &o, const Vec3f &d, float ptMin = 0.f, float ptMax = INFINITY, const Medium *medium = nullptr):
-			mOrigin(o), mDirection(d), tMin(ptMin), tMax(ptMax), mMedium(medium) {}
+		Ray(const Point3f &o, const Vec3f &d, float ptMin = 0.f, float ptMax = INFINITY, float time = 0.f,
+			const Medium *medium = nullptr):
+			mOrigin(o), mDirection(d), tMin(ptMin), tMax(ptMax), mTime(time), mMedium(medium) {}
 
 		Point3f operator()(float t) const { return mOrigin + mDirection * t; }
 
 		friend std::ostream &operator<<(std::ostream &os, const Ray &r) {
 			os << "[o=" << r.mOrigin << ", d=" << r.mDirection << ", tMin=" << r.tMin
-				<< ", tMax=" << r.tMax << "]";
+				<< ", tMax=" << r.tMax << ", time=" << r.mTime << "]";
 			return os;
 		}
 
 		Point3f mOrigin;
 		Vec3f mDirection;
 		mutable float tMin, tMax;
+		float mTime;  // for motion blur
 		const Medium *mMedium;
 	};
 
@@ -33,8 +35,9 @@ namespace Hebex
 
 		RayDifferential() { hasDifferentials = false; }
 
-		RayDifferential(const Point3f &o, const Vec3f &d, float ptMin = 0.f, float ptMax = INFINITY, const Medium *medium = nullptr) :
-			Ray(o, d, ptMin, ptMax, medium) {
+		RayDifferential(const Point3f &o, const Vec3f &d, float ptMin = 0.f, float ptMax = INFINITY, float time = 0.f,
+			const Medium *medium = nullptr) :
+			Ray(o, d, ptMin, ptMax, time, medium) {
 			hasDifferentials = false;
 		}
 
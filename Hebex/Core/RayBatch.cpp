@@ -0,0 +1,40 @@
+#include "RayBatch.h"
+#include "Ray.h"
+#include "MemoryPool.h"
+
+namespace Hebex
+{
+	RayBatch::RayBatch(int capacity) : mCapacity(capacity) {
+		// Round every array up to whole cache lines
+		const int floatsPerLine = L1_CACHE_LINE_SIZE / sizeof(float);
+		size_t stride = (capacity + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+		mData = AllocAligned<float>(8 * stride);
+		float **arrays[8] = { &mOriginX, &mOriginY, &mOriginZ,
+			&mDirectionX, &mDirectionY, &mDirectionZ, &tMin, &tMax };
+		for (int i = 0; i < 8; ++i)
+			*arrays[i] = mData + i * stride;
+	}
+
+	RayBatch::~RayBatch() {
+		FreeAligned(mData);
+	}
+
+	int RayBatch::Add(const Ray &ray) {
+		if (mCount == mCapacity) return -1;
+		int i = mCount++;
+		mOriginX[i] = ray.mOrigin.x;
+		mOriginY[i] = ray.mOrigin.y;
+		mOriginZ[i] = ray.mOrigin.z;
+		mDirectionX[i] = ray.mDirection.x;
+		mDirectionY[i] = ray.mDirection.y;
+		mDirectionZ[i] = ray.mDirection.z;
+		tMin[i] = ray.tMin;
+		tMax[i] = ray.tMax;
+		return i;
+	}
+
+	Ray RayBatch::GetRay(int i) const {
+		return Ray(Point3f(mOriginX[i], mOriginY[i], mOriginZ[i]),
+			Vec3f(mDirectionX[i], mDirectionY[i], mDirectionZ[i]), tMin[i], tMax[i]);
+	}
+}
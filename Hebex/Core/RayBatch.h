@@ -0,0 +1,42 @@
+#ifndef RAYBATCH_H
+#define RAYBATCH_H
+
+#include "../ForwardDecl.h"
+#include "Hebex.h"
+
+namespace Hebex
+{
+	// Structure-of-arrays storage for a batch of rays. Every array starts on a
+	// cache line, so SIMD kernels can load 8 consecutive rays per component.
+	class RayBatch {
+	public:
+		RayBatch(int capacity);
+
+		~RayBatch();
+
+		// Returns the index of the added ray, or -1 if the batch is full
+		int Add(const Ray &ray);
+
+		Ray GetRay(int i) const;
+
+		void Clear() { mCount = 0; }
+
+		int Size() const { return mCount; }
+
+		int Capacity() const { return mCapacity; }
+
+		float *mOriginX, *mOriginY, *mOriginZ;
+		float *mDirectionX, *mDirectionY, *mDirectionZ;
+		float *tMin, *tMax;
+
+	private:
+		RayBatch(const RayBatch &) = delete;
+		RayBatch &operator=(const RayBatch &) = delete;
+
+		int mCount = 0;
+		int mCapacity;
+		float *mData;
+	};
+}
+
+#endif
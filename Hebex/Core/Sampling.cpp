@@ -1,8 +1,162 @@
 #include "Sampling.h"
 #include "Geometry.h"
+#include "MemoryPool.h"
+#include "Parallel.h"
+#include "Simd.h"
 
 namespace Hebex
 {
+	// Bytes of count T, rounded up to whole cache lines
+	template <typename T>
+	static size_t LineBytes(size_t count) {
+		return (count * sizeof(T) + L1_CACHE_LINE_SIZE - 1) / L1_CACHE_LINE_SIZE * L1_CACHE_LINE_SIZE;
+	}
+
+	Distribution1D::Distribution1D(const float *f, int n, CDFSearch search) {
+		count = n;
+		size_t guideBytes = search == CDFSearch::Guide ? LineBytes<int>(n) : 0;
+		uint8_t *block = AllocAligned<uint8_t>(LineBytes<float>(n) + LineBytes<float>(n + 1) +
+			LineBytes<AliasBin>(n) + guideBytes);
+		func = (float *)block;
+		cdf = (float *)(block + LineBytes<float>(n));
+		alias = (AliasBin *)(block + LineBytes<float>(n) + LineBytes<float>(n + 1));
+		funcInt = BuildCDF(f, n, func, cdf);
+
+		BuildAliasTable();
+		if (guideBytes) {
+			guide = (int *)((uint8_t *)alias + LineBytes<AliasBin>(n));
+			BuildGuide(cdf, count, guide);
+		}
+	}
+
+	Distribution1D::~Distribution1D() {
+		FreeAligned(func);
+	}
+
+	float Distribution1D::BuildCDF(const float *f, int n, float *func, float *cdf) {
+		memcpy(func, f, n * sizeof(float));
+
+		cdf[0] = 0.f;
+		for (int i = 1; i < n + 1; ++i)
+			cdf[i] = cdf[i - 1] + func[i - 1] / n;
+
+		//transform function intergral into cdf
+		float funcInt = cdf[n];
+		if (funcInt == 0.f) {
+			for (int i = 1; i < n + 1; ++i)
+				cdf[i] = float(i) / float(n);
+		}
+		else {
+			for (int i = 1; i < n + 1; ++i)
+				cdf[i] /= funcInt;
+		}
+		return funcInt;
+	}
+
+	void Distribution1D::BuildGuide(const float *cdf, int count, int *guide) {
+		// In double, where cdf[i] * count <= k is exact, so every u with
+		// int(u * count) == k is known to lie at or after guide[k]
+		int i = 0;
+		for (int k = 0; k < count; ++k) {
+			while (i + 1 < count && double(cdf[i + 1]) * count <= k) ++i;
+			guide[k] = i;
+		}
+	}
+
+	// Number of cdf[first, last] not above u, given that they are sorted
+	HEBEX_TARGET_AVX2
+	static int CountNotAboveAVX2(const float *cdf, int first, int last, float u) {
+		const __m256 uu = _mm256_set1_ps(u);
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		int n = 0;
+		for (int i = first; i <= last; i += 8) {
+			// Masked loads never read past last, which may end the allocation
+			__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(last - i + 1), lanes);
+			__m256 values = _mm256_maskload_ps(cdf + i, valid);
+			__m256 notAbove = _mm256_and_ps(_mm256_cmp_ps(values, uu, _CMP_LE_OQ), _mm256_castsi256_ps(valid));
+			int mask = _mm256_movemask_ps(notAbove);
+			n += PopCount(mask);
+			if (mask != 0xff) break;
+		}
+		return n;
+	}
+
+	static int CountNotAbove(const float *cdf, int first, int last, float u) {
+		int n = 0;
+		while (first + n <= last && cdf[first + n] <= u) ++n;
+		return n;
+	}
+
+	static const bool sGuideAVX2 = HasAVX2();
+
+	int Distribution1D::FindIntervalGuided(const float *cdf, const int *guide, int count, float u) {
+		int k = Clamp(int(double(u) * count), 0, count - 1);
+		int lo = guide[k];
+		int hi = k + 1 < count ? guide[k + 1] : count - 1;
+		int offset;
+		// Cells spanning many intervals only occur under spikes of the function
+		if (hi - lo > 64)
+			offset = std::max(0, int(std::upper_bound(cdf + lo + 1, cdf + hi + 1, u) - cdf - 1));
+		else if (sGuideAVX2)
+			offset = lo + CountNotAboveAVX2(cdf, lo + 1, hi, u);
+		else
+			offset = lo + CountNotAbove(cdf, lo + 1, hi, u);
+		HEBEX_ASSERT(u >= cdf[offset] && u < cdf[offset + 1]);
+		return offset;
+	}
+
+	void Distribution1D::BuildAliasTable() {
+		// Bin probabilities scaled by count, so the average bin holds 1
+		double sum = 0;
+		for (int i = 0; i < count; ++i) sum += func[i];
+		std::vector<double> p(count);
+		for (int i = 0; i < count; ++i)
+			p[i] = sum > 0 ? func[i] / sum * count : 1.;
+
+		std::vector<int> small, large;
+		for (int i = 0; i < count; ++i)
+			(p[i] < 1. ? small : large).push_back(i);
+
+		// Each underfull bin is topped up by one overfull bin
+		while (!small.empty() && !large.empty()) {
+			int s = small.back(), l = large.back();
+			small.pop_back();
+			large.pop_back();
+			alias[s].q = float(p[s]);
+			alias[s].alias = l;
+			p[l] -= 1. - p[s];
+			(p[l] < 1. ? small : large).push_back(l);
+		}
+		// Whatever remains is full up to rounding error
+		for (int i : small) alias[i] = { 1.f, i };
+		for (int i : large) alias[i] = { 1.f, i };
+	}
+
+	Distribution2D::Distribution2D(const float *func, int nu, int nv, CDFSearch search) : nu(nu), nv(nv) {
+		mCdfOffset = LineBytes<float>(nu) / sizeof(float);
+		mRowStride = mCdfOffset + LineBytes<float>(nu + 1) / sizeof(float);
+		mGuideOffset = 0;
+		if (search == CDFSearch::Guide) {
+			mGuideOffset = mRowStride;
+			mRowStride += LineBytes<int>(nu) / sizeof(float);
+		}
+		mRows = AllocAligned<float>(mRowStride * nv);
+
+		std::vector<float> marginalFunc(nv);
+		ParallelFor([&](int64_t v) {
+			float *row = mRows + v * mRowStride;
+			marginalFunc[v] = Distribution1D::BuildCDF(&func[v * nu], nu, row, row + mCdfOffset);
+			if (mGuideOffset)
+				Distribution1D::BuildGuide(row + mCdfOffset, nu, (int *)(row + mGuideOffset));
+		}, nv, std::max(1, 16384 / nu));
+		pMarginal = new Distribution1D(&marginalFunc[0], nv, search);
+	}
+
+	Distribution2D::~Distribution2D() {
+		delete pMarginal;
+		FreeAligned(mRows);
+	}
+
 	Vec3f UniformSampleSphere(const Point2f &u) {
 		float z = 1 - 2 * u[0];
 		float r = std::sqrt(std::max(0.f, 1.f - z * z));
@@ -37,4 +191,9 @@ namespace Hebex
 			cosTheta * z;
 	}
 
+	Point2f UniformSampleTriangle(const Point2f &u) {
+		float su0 = std::sqrt(u[0]);
+		return Point2f(1 - su0, u[1] * su0);
+	}
+
 }
\ No newline at end of file
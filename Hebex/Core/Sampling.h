@@ -7,40 +7,92 @@
 
 namespace Hebex 
 {
+	// Bin of the alias table: the bin's own index is kept with probability q,
+	// otherwise alias is returned
+	struct AliasBin {
+		float q;
+		int alias;
+	};
+
+	// How the CDF interval holding u is found
+	enum class CDFSearch {
+		Binary,  // std::upper_bound, one likely cache miss per step on large CDFs
+		Guide    // guide table of one int per bin, expected constant time
+	};
+
 	struct Distribution1D {
-		Distribution1D(const float *f, int n) {
-			count = n;
-			func = new float[n];
-			memcpy(func, f, n * sizeof(float));
-			cdf = new float[n + 1];
-
-			cdf[0] = 0.f;
-			for (int i = 1; i < count + 1; ++i) 
-				cdf[i] = cdf[i - 1] + func[i - 1] / n;
-
-			//transform function intergral into cdf
-			funcInt = cdf[count];
-			if (funcInt == 0.f) {
-				for (int i = 1; i < n + 1; ++i)
-					cdf[i] = float(i) / float(n);
+		Distribution1D(const float *f, int n, CDFSearch search = CDFSearch::Binary);
+
+		~Distribution1D();
+
+		float SampleContinuous(float u, float *pdf, int *off = nullptr) const {
+			return SampleCDF(func, cdf, guide, funcInt, count, u, pdf, off);
+		}
+
+		int SampleDiscrete(float u, float *pdf) const {
+			int offset = FindInterval(cdf, guide, count, u);
+			if (pdf) *pdf = func[offset] / (funcInt * count);
+
+			return offset;
+		}
+
+		// Same distribution as SampleDiscrete in constant time, through the
+		// alias table, but neighbouring u may map to distant offsets, which
+		// breaks up stratified samples. uRemapped gets a fresh uniform
+		// sample derived from the unused bits of u.
+		int SampleAlias(float u, float *pdf, float *uRemapped = nullptr) const {
+			// In double, so the fraction keeps its precision for large counts
+			double scaled = double(u) * count;
+			int offset = std::min(int(scaled), count - 1);
+			float up = std::min(float(scaled - offset), OneMinusEpsilon);
+			const AliasBin &bin = alias[offset];
+			if (up < bin.q) {
+				if (uRemapped) *uRemapped = std::min(up / bin.q, OneMinusEpsilon);
 			}
 			else {
-				for (int i = 1; i < n + 1; ++i)
-					cdf[i] /= funcInt;
+				if (uRemapped) *uRemapped = std::min((up - bin.q) / (1 - bin.q), OneMinusEpsilon);
+				offset = bin.alias;
 			}
-		}
+			if (pdf) *pdf = func[offset] / (funcInt * count);
 
-		~Distribution1D() {
-			delete[] func;
-			delete[] cdf;
+			return offset;
 		}
 
-		float SampleContinuous(float u, float *pdf, int *off = nullptr) const {
-			float *ptr = std::upper_bound(cdf, cdf + count + 1, u);
+		int Count() const { return count; }
+
+		float Integral() const { return funcInt; }
+
+	private:
+		Distribution1D(const Distribution1D &) = delete;
+		Distribution1D &operator=(const Distribution1D &) = delete;
+
+		// Fills func and cdf from f and returns the integral of f; also
+		// builds the rows of Distribution2D in place
+		static float BuildCDF(const float *f, int n, float *func, float *cdf);
+
+		// Cell k of the guide table holds the interval containing k / count
+		static void BuildGuide(const float *cdf, int count, int *guide);
+
+		// Offset of the interval of cdf holding u; binary search without a
+		// guide table
+		static int FindInterval(const float *cdf, const int *guide, int count, float u) {
+			if (guide) return FindIntervalGuided(cdf, guide, count, u);
+			const float *ptr = std::upper_bound(cdf, cdf + count + 1, u);
 			int offset = std::max(0, int(ptr - cdf - 1));
-			if (off) *off = offset;
 			HEBEX_ASSERT(offset < count);
 			HEBEX_ASSERT(u >= cdf[offset] && u < cdf[offset + 1]);
+			return offset;
+		}
+
+		// Narrows the search to the intervals between u's guide cell and the
+		// next one, usually a handful, and counts the cdf values below u
+		// there eight at a time
+		static int FindIntervalGuided(const float *cdf, const int *guide, int count, float u);
+
+		static float SampleCDF(const float *func, const float *cdf, const int *guide, float funcInt,
+			int count, float u, float *pdf, int *off) {
+			int offset = FindInterval(cdf, guide, count, u);
+			if (off) *off = offset;
 
 			float du = (u - cdf[offset]) / (cdf[offset + 1] - cdf[offset]);
 			HEBEX_ASSERT(!IsNaN(du));
@@ -50,66 +102,63 @@ namespace Hebex
 			return (offset + du) / count;
 		}
 
-		int SampleDiscrete(float u, float *pdf) const {
-			float *ptr = std::upper_bound(cdf, cdf + count + 1, u);
-			int offset = std::max(0, int(ptr - cdf - 1));
-			HEBEX_ASSERT(offset < count);
-			HEBEX_ASSERT(u >= cdf[offset] && u < cdf[offset + 1]);
-			if (pdf) *pdf = func[offset] / (funcInt * count);
+		// Vose's method, O(n)
+		void BuildAliasTable();
 
-			return offset;
-		}
-
-	private:
 		friend struct Distribution2D;
+		// func, cdf, alias and guide share one aligned block, each array
+		// starting on a cache line
 		float *func, *cdf;
+		AliasBin *alias;
+		int *guide = nullptr;
 		float funcInt;
 		int count;
 	};
 
+	// The conditional distributions of all rows are stored back to back in
+	// one aligned block, each row's func and cdf adjacent and starting on a
+	// cache line; a row is found by offset rather than through a pointer, and
+	// its integral is the marginal's func value
 	struct Distribution2D {
-		// Distribution2D Public Methods
-		Distribution2D(const float *func, int nu, int nv) {
-			pConditionalV.reserve(nv);
-			for (int v = 0; v < nv; ++v) {
-				// Compute conditional sampling distribution for $\tilde{v}$
-				pConditionalV.push_back(new Distribution1D(&func[v * nu], nu));
-			}
-			// Compute marginal sampling distribution $p[\tilde{v}]$
-			std::vector<float> marginalFunc;
-			marginalFunc.reserve(nv);
-			for (int v = 0; v < nv; ++v)
-				marginalFunc.push_back(pConditionalV[v]->funcInt);
-			pMarginal = new Distribution1D(&marginalFunc[0], nv);
-		}
+		// Rows are built in parallel; search applies to them and the marginal
+		Distribution2D(const float *func, int nu, int nv, CDFSearch search = CDFSearch::Binary);
 
-		~Distribution2D() {
-			delete pMarginal;
-			for (uint32_t i = 0; i < pConditionalV.size(); ++i)
-				delete pConditionalV[i];
-		}
+		~Distribution2D();
 
 		void SampleContinuous(float u0, float u1, float uv[2],
 			float *pdf) const {
 			float pdfs[2];
 			int v;
 			uv[1] = pMarginal->SampleContinuous(u1, &pdfs[1], &v);
-			uv[0] = pConditionalV[v]->SampleContinuous(u0, &pdfs[0]);
+			uv[0] = Distribution1D::SampleCDF(RowFunc(v), RowCdf(v), RowGuide(v), pMarginal->func[v],
+				nu, u0, &pdfs[0], nullptr);
 			*pdf = pdfs[0] * pdfs[1];
 		}
 
 		float Pdf(float u, float v) const {
-			int iu = Clamp(int(u * pConditionalV[0]->count), 0,
-				pConditionalV[0]->count - 1);
-			int iv = Clamp(int(v * pMarginal->count), 0,
-				pMarginal->count - 1);
-			if (pConditionalV[iv]->funcInt * pMarginal->funcInt == 0.f) return 0.f;
-			return (pConditionalV[iv]->func[iu] * pMarginal->func[iv]) /
-				(pConditionalV[iv]->funcInt * pMarginal->funcInt);
+			int iu = Clamp(int(u * nu), 0, nu - 1);
+			int iv = Clamp(int(v * nv), 0, nv - 1);
+			float rowInt = pMarginal->func[iv];
+			if (rowInt * pMarginal->funcInt == 0.f) return 0.f;
+			return (RowFunc(iv)[iu] * pMarginal->func[iv]) /
+				(rowInt * pMarginal->funcInt);
 		}
+
 	private:
-		// Distribution2D Private Data
-		std::vector<Distribution1D *> pConditionalV;
+		Distribution2D(const Distribution2D &) = delete;
+		Distribution2D &operator=(const Distribution2D &) = delete;
+
+		const float *RowFunc(int v) const { return mRows + v * mRowStride; }
+
+		const float *RowCdf(int v) const { return mRows + v * mRowStride + mCdfOffset; }
+
+		const int *RowGuide(int v) const {
+			return mGuideOffset ? (const int *)(mRows + v * mRowStride + mGuideOffset) : nullptr;
+		}
+
+		int nu, nv;
+		size_t mRowStride, mCdfOffset, mGuideOffset;  // in floats; no guide if 0
+		float *mRows;
 		Distribution1D *pMarginal;
 	};
 
@@ -122,6 +171,9 @@ namespace Hebex
 	Vec3f UniformSampleCone(const Point2f &u, float thetamax, const Vec3f &x,
 		const Vec3f &y, const Vec3f &z);
 	float UniformConePdf(float thetamax);
+
+	// Barycentric coordinates (b0, b1) uniformly distributed over a triangle
+	Point2f UniformSampleTriangle(const Point2f &u);
 	
 }
 
@@ -7,7 +7,7 @@
 
 namespace Hebex
 {
-	Shape::Shape(const Transform *o2w, const Transform *w2o) :
+	Shape::Shape(const AffineTransform *o2w, const AffineTransform *w2o) :
 		ObjectToWorld(o2w), WorldToObject(w2o), shapeId(nextShapeId++) {
 
 	}
@@ -28,14 +28,23 @@ namespace Hebex
 
 	}
 
+	bool Shape::Intersect(const Ray &ray, float *tHit, Intersection *isect) const {
+		SurfaceHit hit;
+		if (!IntersectHit(ray, &hit)) return false;
+		ComputeSurfaceInteraction(ray, hit, isect);
+		*tHit = hit.t;
+		return true;
+	}
+
 	float Shape::Area() const {
 		return 0.f;
 	}
 
 	float Shape::Pdf(const Point3f &p, const Vec3f &wi) const {
 		Intersection isect;
+		float tHit;
 		Ray ray(p, wi, 1e-3f);
-		if (!Intersect(ray, &isect)) return 0.f;
+		if (!Intersect(ray, &tHit, &isect)) return 0.f;
 
 		float pdf = DistanceSquared(p, isect.mPosition) / (AbsDot(isect.mNormal, -wi) * Area());
 
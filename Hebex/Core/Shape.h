@@ -7,10 +7,14 @@
 
 namespace Hebex
 {
+	// Concrete shapes that aggregates intersect without virtual dispatch; a
+	// TriangleMesh is expanded into one leaf entry per triangle
+	enum class ShapeType : uint8_t { Generic, Sphere, TriangleMesh };
+
 	class Shape {
 	public:
 		//Shape Interface
-		Shape(const Transform *o2w, const Transform *w2o);
+		Shape(const AffineTransform *o2w, const AffineTransform *w2o);
 
 		virtual ~Shape();
 
@@ -21,8 +25,19 @@ namespace Hebex
 		virtual bool Intersectable() const;
 
 		virtual void Refine(std::vector<std::shared_ptr<Shape> > &refined) const;
+
+		virtual ShapeType GetType() const { return ShapeType::Generic; }
 		
-		virtual bool Intersect(const Ray &ray, Intersection *isect) const = 0;
+		// Cheap part of the intersection: finds t and the shape's own hit
+		// parameters, u, v and elementId. The aggregate ids of the hit are
+		// left to the caller.
+		virtual bool IntersectHit(const Ray &ray, SurfaceHit *hit) const = 0;
+
+		// Expensive part, run once for the hit that is finally kept, with the
+		// ray that found it
+		virtual void ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const = 0;
+
+		bool Intersect(const Ray &ray, float *tHit, Intersection *isect) const;
 		
 		virtual bool IntersectP(const Ray &ray) const = 0;
 		
@@ -39,7 +54,7 @@ namespace Hebex
 		virtual float Pdf(const Point3f &p, const Vec3f &wi) const;
 
 
-		const Transform *ObjectToWorld, *WorldToObject;
+		const AffineTransform *ObjectToWorld, *WorldToObject;
 		const uint32_t shapeId;
 		static uint32_t nextShapeId;
 
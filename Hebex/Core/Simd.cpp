@@ -0,0 +1,65 @@
+#include "Simd.h"
+
+#if !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
+namespace Hebex
+{
+	static void CpuId(int leaf, int subLeaf, int regs[4]) {
+#if defined(_MSC_VER)
+		__cpuidex(regs, leaf, subLeaf);
+#else
+		unsigned int a, b, c, d;
+		__cpuid_count(leaf, subLeaf, a, b, c, d);
+		regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+	}
+
+	static uint64_t ReadXCR0() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return ((uint64_t)hi << 32) | lo;
+#endif
+	}
+
+	struct CpuFeatures {
+		CpuFeatures() {
+			int regs[4];
+			CpuId(0, 0, regs);
+			int maxLeaf = regs[0];
+			if (maxLeaf < 1) return;
+
+			CpuId(1, 0, regs);
+			sse41 = (regs[2] & (1 << 19)) != 0;
+			bool osxsave = (regs[2] & (1 << 27)) != 0;
+			bool avx = (regs[2] & (1 << 28)) != 0;
+			bool fma = (regs[2] & (1 << 12)) != 0;
+			if (!osxsave || !avx || !fma || maxLeaf < 7) return;
+
+			// The OS must save the YMM state across context switches
+			if ((ReadXCR0() & 0x6) != 0x6) return;
+			CpuId(7, 0, regs);
+			avx2 = (regs[1] & (1 << 5)) != 0;
+		}
+
+		bool sse41 = false;
+		bool avx2 = false;
+	};
+
+	static const CpuFeatures &GetCpuFeatures() {
+		static const CpuFeatures features;
+		return features;
+	}
+
+	bool HasSSE41() {
+		return GetCpuFeatures().sse41;
+	}
+
+	bool HasAVX2() {
+		return GetCpuFeatures().avx2;
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "Hebex.h"
+#include <immintrin.h>
+
+// Code using AVX2/FMA intrinsics is compiled for that target only and must
+// be guarded by a HasAVX2() check at runtime. MSVC accepts the intrinsics
+// without a per-function target.
+#if defined(_MSC_VER)
+#define HEBEX_TARGET_AVX2
+#else
+#define HEBEX_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+// AVX2 without FMA, for code that must round exactly like its scalar
+// equivalent; the compiler may otherwise fuse multiplies and adds
+#if defined(_MSC_VER)
+#define HEBEX_TARGET_AVX2_NOFMA
+#else
+#define HEBEX_TARGET_AVX2_NOFMA __attribute__((target("avx2")))
+#endif
+
+namespace Hebex
+{
+	bool HasSSE41();
+
+	bool HasAVX2();
+
+	inline int CountTrailingZeros(uint32_t v) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, v);
+		return (int)index;
+#else
+		return __builtin_ctz(v);
+#endif
+	}
+
+	inline int PopCount(uint32_t v) {
+#if defined(_MSC_VER)
+		return (int)__popcnt(v);
+#else
+		return __builtin_popcount(v);
+#endif
+	}
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef THREADLOCAL_H
+#define THREADLOCAL_H
+
+#include "Hebex.h"
+#include "Parallel.h"
+#include <functional>
+#include <mutex>
+
+namespace Hebex
+{
+	// One T per thread, found through GetThreadIndex. Each thread's instance
+	// is created by its own first Get, so it is allocated, and first touched,
+	// by the thread that uses it, and slots of different threads never share
+	// a cache line. Indices below MaxThreadIndex() map to a table sized at
+	// construction; other threads get slots in segments added on demand,
+	// which never move once published. A thread that exits leaves its
+	// instance to the next thread given the same index.
+	template <typename T>
+	class ThreadLocal {
+	public:
+		ThreadLocal() : ThreadLocal([]() { return new T(); }) {}
+
+		explicit ThreadLocal(const std::function<T *()> &create) :
+			mCreate(create), mItems(MaxThreadIndex()) {
+		}
+
+		~ThreadLocal() {
+			for (auto &segment : mSegments) delete[] segment.load(std::memory_order_relaxed);
+		}
+
+		T &Get() {
+			int index = GetThreadIndex();
+			std::unique_ptr<T> &item = index < (int)mItems.size() ? mItems[index] :
+				OverflowSlot(index - (int)mItems.size());
+			if (!item) item.reset(mCreate());
+			return *item;
+		}
+
+		// Visits every instance created so far. Must not race with Get from
+		// other threads.
+		template <typename F>
+		void ForAll(F func) {
+			for (auto &item : mItems)
+				if (item) func(*item);
+			for (auto &segment : mSegments)
+				if (std::unique_ptr<T> *slots = segment.load(std::memory_order_acquire))
+					for (int i = 0; i < SegmentSize; ++i)
+						if (slots[i]) func(*slots[i]);
+		}
+
+		template <typename F>
+		void ForAll(F func) const {
+			for (const auto &item : mItems)
+				if (item) func(static_cast<const T &>(*item));
+			for (const auto &segment : mSegments)
+				if (const std::unique_ptr<T> *slots = segment.load(std::memory_order_acquire))
+					for (int i = 0; i < SegmentSize; ++i)
+						if (slots[i]) func(static_cast<const T &>(*slots[i]));
+		}
+
+	private:
+		ThreadLocal(const ThreadLocal &) = delete;
+		ThreadLocal &operator=(const ThreadLocal &) = delete;
+
+		static const int SegmentSize = 64, MaxSegments = 64;
+
+		std::unique_ptr<T> &OverflowSlot(int i) {
+			HEBEX_ASSERT(i < SegmentSize * MaxSegments);
+			std::atomic<std::unique_ptr<T> *> &segment = mSegments[i / SegmentSize];
+			std::unique_ptr<T> *slots = segment.load(std::memory_order_acquire);
+			if (!slots) {
+				std::lock_guard<std::mutex> lock(mSegmentMutex);
+				slots = segment.load(std::memory_order_relaxed);
+				if (!slots) {
+					slots = new std::unique_ptr<T>[SegmentSize];
+					segment.store(slots, std::memory_order_release);
+				}
+			}
+			return slots[i % SegmentSize];
+		}
+
+		std::function<T *()> mCreate;
+		std::vector<std::unique_ptr<T> > mItems;
+		std::atomic<std::unique_ptr<T> *> mSegments[MaxSegments] = {};
+		std::mutex mSegmentMutex;
+	};
+}
+
+#endif
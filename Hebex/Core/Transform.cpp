@@ -1,4 +1,6 @@
 #include "Transform.h"
+#include "Simd.h"
+#include "Parallel.h"
 
 namespace Hebex
 {
@@ -34,8 +36,19 @@ namespace Hebex
 			m.m[0][3], m.m[1][3], m.m[2][3], m.m[3][3]);
 	}
 
-	Matrix4x4 Inverse(const Matrix4x4 &m) {
-		
+	static Matrix4x4 MulScalar(const Matrix4x4 &m1, const Matrix4x4 &m2) {
+		Matrix4x4 r;
+		for (int i = 0; i < 4; ++i)
+			for (int j = 0; j < 4; ++j)
+				r.m[i][j] = m1.m[i][0] * m2.m[0][j] +
+				m1.m[i][1] * m2.m[1][j] +
+				m1.m[i][2] * m2.m[2][j] +
+				m1.m[i][3] * m2.m[3][j];
+		return r;
+	}
+
+	// Gauss-Jordan elimination with full pivoting
+	static Matrix4x4 InverseScalar(const Matrix4x4 &m) {
 		int indxc[4], indxr[4];
 		int ipiv[4] = { 0, 0, 0, 0 };
 		float minv[4][4];
@@ -96,6 +109,168 @@ namespace Hebex
 		return Matrix4x4(minv);
 	}
 
+	// Row i of the product is the sum of m2's rows weighted by m1[i][k],
+	// accumulated in the same order as MulScalar
+	static Matrix4x4 MulSSE(const Matrix4x4 &m1, const Matrix4x4 &m2) {
+		Matrix4x4 r;
+		__m128 b0 = _mm_loadu_ps(m2.m[0]);
+		__m128 b1 = _mm_loadu_ps(m2.m[1]);
+		__m128 b2 = _mm_loadu_ps(m2.m[2]);
+		__m128 b3 = _mm_loadu_ps(m2.m[3]);
+		for (int i = 0; i < 4; ++i) {
+			__m128 row = _mm_mul_ps(_mm_set1_ps(m1.m[i][0]), b0);
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m1.m[i][1]), b1));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m1.m[i][2]), b2));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m1.m[i][3]), b3));
+			_mm_storeu_ps(r.m[i], row);
+		}
+		return r;
+	}
+
+	// Two rows per register: each 128-bit lane computes one row as in MulSSE
+	HEBEX_TARGET_AVX2_NOFMA
+	static Matrix4x4 MulAVX2(const Matrix4x4 &m1, const Matrix4x4 &m2) {
+		Matrix4x4 r;
+		__m256 b0 = _mm256_broadcast_ps((const __m128 *)m2.m[0]);
+		__m256 b1 = _mm256_broadcast_ps((const __m128 *)m2.m[1]);
+		__m256 b2 = _mm256_broadcast_ps((const __m128 *)m2.m[2]);
+		__m256 b3 = _mm256_broadcast_ps((const __m128 *)m2.m[3]);
+		for (int i = 0; i < 4; i += 2) {
+			__m256 a = _mm256_loadu_ps(m1.m[i]);
+			__m256 rows = _mm256_mul_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+			rows = _mm256_add_ps(rows, _mm256_mul_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)), b1));
+			rows = _mm256_add_ps(rows, _mm256_mul_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2)), b2));
+			rows = _mm256_add_ps(rows, _mm256_mul_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3)), b3));
+			_mm256_storeu_ps(r.m[i], rows);
+		}
+		return r;
+	}
+
+	// Inverse of the linear part by cofactors, translation as -A^-1 t
+	static Matrix4x4 InverseAffine(const Matrix4x4 &m) {
+		const float (*a)[4] = m.m;
+		float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+		float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+		float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+		float det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+		if (det == 0.f) return Matrix4x4::Identity();
+		float invDet = 1.f / det;
+
+		float r[4][4];
+		r[0][0] = c00 * invDet;
+		r[1][0] = c01 * invDet;
+		r[2][0] = c02 * invDet;
+		r[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * invDet;
+		r[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * invDet;
+		r[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * invDet;
+		r[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * invDet;
+		r[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * invDet;
+		r[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * invDet;
+		for (int i = 0; i < 3; ++i)
+			r[i][3] = -(r[i][0] * a[0][3] + r[i][1] * a[1][3] + r[i][2] * a[2][3]);
+		r[3][0] = r[3][1] = r[3][2] = 0.f;
+		r[3][3] = 1.f;
+		return Matrix4x4(r);
+	}
+
+	// 2x2 matrices packed row-major in one register
+	static inline __m128 Mat2Mul(__m128 a, __m128 b) {
+		return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 3, 0))),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+	}
+
+	// adj(a) * b
+	static inline __m128 Mat2AdjMul(__m128 a, __m128 b) {
+		return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 3, 3)), b),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 1, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+
+	// a * adj(b)
+	static inline __m128 Mat2MulAdj(__m128 a, __m128 b) {
+		return _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 3, 0, 3))),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+	}
+
+	// Block inverse of M = [A B; C D] from the adjugates of its 2x2 blocks
+	static Matrix4x4 InverseSSE(const Matrix4x4 &m) {
+		__m128 r0 = _mm_loadu_ps(m.m[0]);
+		__m128 r1 = _mm_loadu_ps(m.m[1]);
+		__m128 r2 = _mm_loadu_ps(m.m[2]);
+		__m128 r3 = _mm_loadu_ps(m.m[3]);
+		__m128 A = _mm_movelh_ps(r0, r1);
+		__m128 B = _mm_movehl_ps(r1, r0);
+		__m128 C = _mm_movelh_ps(r2, r3);
+		__m128 D = _mm_movehl_ps(r3, r2);
+
+		// (|A|, |B|, |C|, |D|)
+		__m128 detSub = _mm_sub_ps(
+			_mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(3, 1, 3, 1))),
+			_mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(2, 0, 2, 0))));
+		__m128 detA = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(0, 0, 0, 0));
+		__m128 detB = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(1, 1, 1, 1));
+		__m128 detC = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(2, 2, 2, 2));
+		__m128 detD = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(3, 3, 3, 3));
+
+		// M^-1 = 1/|M| [X Y; Z W], computed as the adjugates of X, Y, Z, W
+		__m128 D_C = Mat2AdjMul(D, C);
+		__m128 A_B = Mat2AdjMul(A, B);
+		__m128 X_ = _mm_sub_ps(_mm_mul_ps(detD, A), Mat2Mul(B, D_C));
+		__m128 W_ = _mm_sub_ps(_mm_mul_ps(detA, D), Mat2Mul(C, A_B));
+		__m128 Y_ = _mm_sub_ps(_mm_mul_ps(detB, C), Mat2MulAdj(D, A_B));
+		__m128 Z_ = _mm_sub_ps(_mm_mul_ps(detC, B), Mat2MulAdj(A, D_C));
+
+		// |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+		__m128 tr = _mm_mul_ps(A_B, _mm_shuffle_ps(D_C, D_C, _MM_SHUFFLE(3, 1, 2, 0)));
+		tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(2, 3, 0, 1)));
+		tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128 detM = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+		if (_mm_cvtss_f32(detM) == 0.f) return Matrix4x4::Identity();
+
+		__m128 rDetM = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), detM);
+		X_ = _mm_mul_ps(X_, rDetM);
+		Y_ = _mm_mul_ps(Y_, rDetM);
+		Z_ = _mm_mul_ps(Z_, rDetM);
+		W_ = _mm_mul_ps(W_, rDetM);
+
+		// Undo the adjugates while scattering the blocks back to rows
+		Matrix4x4 r;
+		_mm_storeu_ps(r.m[0], _mm_shuffle_ps(X_, Y_, _MM_SHUFFLE(1, 3, 1, 3)));
+		_mm_storeu_ps(r.m[1], _mm_shuffle_ps(X_, Y_, _MM_SHUFFLE(0, 2, 0, 2)));
+		_mm_storeu_ps(r.m[2], _mm_shuffle_ps(Z_, W_, _MM_SHUFFLE(1, 3, 1, 3)));
+		_mm_storeu_ps(r.m[3], _mm_shuffle_ps(Z_, W_, _MM_SHUFFLE(0, 2, 0, 2)));
+		return r;
+	}
+
+	static MatrixBackend BestMatrixBackend() {
+		return HasAVX2() ? MatrixBackend::AVX2 : MatrixBackend::SSE;
+	}
+
+	// Zero-initialized to Scalar until dynamic initialization has run
+	static MatrixBackend sMatrixBackend = BestMatrixBackend();
+
+	void SetMatrixBackend(MatrixBackend backend) {
+		if (backend == MatrixBackend::AVX2 && !HasAVX2()) backend = MatrixBackend::Scalar;
+		sMatrixBackend = backend;
+	}
+
+	MatrixBackend GetMatrixBackend() {
+		return sMatrixBackend;
+	}
+
+	Matrix4x4 Matrix4x4::Mul(const Matrix4x4 &m1, const Matrix4x4 &m2) {
+		switch (sMatrixBackend) {
+		case MatrixBackend::AVX2: return MulAVX2(m1, m2);
+		case MatrixBackend::SSE: return MulSSE(m1, m2);
+		default: return MulScalar(m1, m2);
+		}
+	}
+
+	Matrix4x4 Inverse(const Matrix4x4 &m) {
+		if (sMatrixBackend == MatrixBackend::Scalar) return InverseScalar(m);
+		if (IsAffine(m)) return InverseAffine(m);
+		return InverseSSE(m);
+	}
+
 	Transform Translate(const Vec3f &delta) {
 		Matrix4x4 m(1, 0, 0, delta.x,
 			0, 1, 0, delta.y,
@@ -240,6 +415,293 @@ namespace Hebex
 	}
 
 
+	AffineTransform::AffineTransform(const Transform &t) {
+		HEBEX_ASSERT(IsAffine(t.GetMatrix()) && IsAffine(t.GetInverseMatrix()));
+		memcpy(m.m, t.GetMatrix().m, sizeof(m.m));
+		memcpy(mInv.m, t.GetInverseMatrix().m, sizeof(mInv.m));
+	}
+
+	Transform AffineTransform::ToTransform() const {
+		Matrix4x4 mat, minv;
+		memcpy(mat.m, m.m, sizeof(m.m));
+		memcpy(minv.m, mInv.m, sizeof(mInv.m));
+		return Transform(mat, minv);
+	}
+
+	// Each output extent is the sum over input axes of the smaller and larger
+	// of the two scaled extents (Arvo), instead of mapping all eight corners
+	BBox AffineTransform::operator()(const BBox &b) const {
+		if (b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z) return BBox();
+		BBox ret;
+		for (int i = 0; i < 3; ++i) {
+			ret.pMin[i] = ret.pMax[i] = m.m[i][3];
+			for (int j = 0; j < 3; ++j) {
+				float a = m.m[i][j] * b.pMin[j];
+				float c = m.m[i][j] * b.pMax[j];
+				ret.pMin[i] += std::min(a, c);
+				ret.pMax[i] += std::max(a, c);
+			}
+		}
+		return ret;
+	}
+
+	static Matrix3x4 Mul(const Matrix3x4 &m1, const Matrix3x4 &m2) {
+		Matrix3x4 r;
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 4; ++j)
+				r.m[i][j] = m1.m[i][0] * m2.m[0][j] + m1.m[i][1] * m2.m[1][j] + m1.m[i][2] * m2.m[2][j];
+			r.m[i][3] += m1.m[i][3];
+		}
+		return r;
+	}
+
+	AffineTransform AffineTransform::operator*(const AffineTransform &t2) const {
+		return AffineTransform(Mul(m, t2.m), Mul(t2.mInv, mInv));
+	}
+
+	NormalMatrix::NormalMatrix(const AffineTransform &t) {
+		const Matrix3x4 &inv = t.GetInverseMatrix();
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				m[i][j] = inv.m[j][i];
+	}
+
+	void TransformNormals(const NormalMatrix &nm, const Normal3f *n, Normal3f *nt, size_t count) {
+		for (size_t i = 0; i < count; ++i)
+			nt[i] = nm(n[i]);
+	}
+
+	// Component arrays of a batched transform, advanced to a sub-range
+	struct SoABatch {
+		SoABatch Offset(size_t start) const {
+			return { x + start, y + start, z + start, xt + start, yt + start, zt + start };
+		}
+
+		const float *x, *y, *z;
+		float *xt, *yt, *zt;
+	};
+
+	// Maps [0, count) of the batch by the 3x4 matrix m; vectors and normals
+	// pass a zero last column
+	static void TransformSoAScalar(const float (*m)[4], const SoABatch &b, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			float x = b.x[i], y = b.y[i], z = b.z[i];
+			b.xt[i] = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+			b.yt[i] = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+			b.zt[i] = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+		}
+	}
+
+	HEBEX_TARGET_AVX2
+	static void TransformSoAAVX2(const float (*m)[4], const SoABatch &b, size_t count) {
+		__m256 r[3][4];
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 4; ++j)
+				r[i][j] = _mm256_set1_ps(m[i][j]);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			// All three inputs are loaded before any store, for in-place batches
+			__m256 x = _mm256_loadu_ps(b.x + i);
+			__m256 y = _mm256_loadu_ps(b.y + i);
+			__m256 z = _mm256_loadu_ps(b.z + i);
+			__m256 out[3];
+			for (int k = 0; k < 3; ++k)
+				out[k] = _mm256_fmadd_ps(r[k][0], x, _mm256_fmadd_ps(r[k][1], y, _mm256_fmadd_ps(r[k][2], z, r[k][3])));
+			_mm256_storeu_ps(b.xt + i, out[0]);
+			_mm256_storeu_ps(b.yt + i, out[1]);
+			_mm256_storeu_ps(b.zt + i, out[2]);
+		}
+		TransformSoAScalar(m, b.Offset(i), count - i);
+	}
+
+	static void TransformSoA(const float (*m)[4], const SoABatch &b, size_t count) {
+		auto kernel = HasAVX2() ? TransformSoAAVX2 : TransformSoAScalar;
+		// Below this the pool's overhead outweighs the split
+		const size_t chunkSize = 64 * 1024;
+		if (count <= chunkSize) {
+			kernel(m, b, count);
+			return;
+		}
+		int64_t nChunks = (count + chunkSize - 1) / chunkSize;
+		ParallelFor([&](int64_t chunk) {
+			size_t start = chunk * chunkSize;
+			kernel(m, b.Offset(start), std::min(chunkSize, count - start));
+		}, nChunks);
+	}
+
+	void TransformPoints(const AffineTransform &t, const float *x, const float *y, const float *z,
+		float *xt, float *yt, float *zt, size_t count) {
+		TransformSoA(t.GetMatrix().m, { x, y, z, xt, yt, zt }, count);
+	}
+
+	void TransformVectors(const AffineTransform &t, const float *x, const float *y, const float *z,
+		float *xt, float *yt, float *zt, size_t count) {
+		Matrix3x4 linear = t.GetMatrix();
+		for (int i = 0; i < 3; ++i) linear.m[i][3] = 0.f;
+		TransformSoA(linear.m, { x, y, z, xt, yt, zt }, count);
+	}
+
+	void TransformNormals(const NormalMatrix &nm, const float *nx, const float *ny, const float *nz,
+		float *ntx, float *nty, float *ntz, size_t count) {
+		float m[3][4];
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 3; ++j) m[i][j] = nm.m[i][j];
+			m[i][3] = 0.f;
+		}
+		TransformSoA(m, { nx, ny, nz, ntx, nty, ntz }, count);
+	}
+
+	bool AffineTransform::SwapsHandedness() const {
+		float det = m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1]) -
+			m.m[0][1] * (m.m[1][0] * m.m[2][2] - m.m[1][2] * m.m[2][0]) +
+			m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+		return det < 0.f;
+	}
+
+	AnimatedTransform::AnimatedTransform(const AffineTransform *startTransform, float startTime,
+		const AffineTransform *endTransform, float endTime) :
+		mStartTransform(startTransform), mEndTransform(endTransform),
+		mStartTime(startTime), mEndTime(endTime),
+		mActuallyAnimated(*startTransform != *endTransform) {
+		if (!mActuallyAnimated) return;
+		Decompose(startTransform->ToTransform().GetMatrix(), &T[0], &R[0], &S[0]);
+		Decompose(endTransform->ToTransform().GetMatrix(), &T[1], &R[1], &S[1]);
+		// Take the shorter arc between the two rotations
+		if (Dot(R[0], R[1]) < 0.f) R[1] = -R[1];
+		// Any rotation at all moves points along arcs, which can leave the
+		// union of the keyframe bounds
+		mHasRotation = R[0].v != R[1].v || R[0].w != R[1].w;
+	}
+
+	void AnimatedTransform::Decompose(const Matrix4x4 &m, Vec3f *T, Quaternion *Rquat, Matrix4x4 *S) {
+		*T = Vec3f(m.m[0][3], m.m[1][3], m.m[2][3]);
+
+		Matrix4x4 M = m;
+		for (int i = 0; i < 3; ++i) M.m[i][3] = M.m[3][i] = 0.f;
+		M.m[3][3] = 1.f;
+
+		// Polar decomposition: average R with its inverse transpose until it
+		// converges to the rotation
+		float norm;
+		int count = 0;
+		Matrix4x4 R = M;
+		do {
+			Matrix4x4 Rnext;
+			Matrix4x4 Rit = Inverse(Transpose(R));
+			for (int i = 0; i < 4; ++i)
+				for (int j = 0; j < 4; ++j)
+					Rnext.m[i][j] = .5f * (R.m[i][j] + Rit.m[i][j]);
+
+			norm = 0.f;
+			for (int i = 0; i < 3; ++i) {
+				float n = std::fabs(R.m[i][0] - Rnext.m[i][0]) +
+					std::fabs(R.m[i][1] - Rnext.m[i][1]) +
+					std::fabs(R.m[i][2] - Rnext.m[i][2]);
+				norm = std::max(norm, n);
+			}
+			R = Rnext;
+		} while (++count < 100 && norm > .0001f);
+		*Rquat = Quaternion(Transform(R, Transpose(R)));
+
+		*S = Matrix4x4::Mul(Inverse(R), M);
+	}
+
+	void AnimatedTransform::Interpolate(float time, AffineTransform *t) const {
+		if (!mActuallyAnimated || time <= mStartTime) {
+			*t = *mStartTransform;
+			return;
+		}
+		if (time >= mEndTime) {
+			*t = *mEndTransform;
+			return;
+		}
+		float dt = (time - mStartTime) / (mEndTime - mStartTime);
+		Vec3f trans = (1.f - dt) * T[0] + dt * T[1];
+		Quaternion rotate = Slerp(dt, R[0], R[1]);
+		Matrix4x4 scale;
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				scale.m[i][j] = Lerp(dt, S[0].m[i][j], S[1].m[i][j]);
+		*t = AffineTransform(Translate(trans) * rotate.ToTransform() * Transform(scale));
+	}
+
+	Ray AnimatedTransform::operator()(const Ray &r) const {
+		Ray ret;
+		(*this)(r, &ret);
+		return ret;
+	}
+
+	void AnimatedTransform::operator()(const Ray &r, Ray *rt) const {
+		if (!mActuallyAnimated || r.mTime <= mStartTime)
+			(*mStartTransform)(r, rt);
+		else if (r.mTime >= mEndTime)
+			(*mEndTransform)(r, rt);
+		else {
+			AffineTransform t;
+			Interpolate(r.mTime, &t);
+			t(r, rt);
+		}
+		rt->mTime = r.mTime;
+	}
+
+	Point3f AnimatedTransform::operator()(float time, const Point3f &p) const {
+		AffineTransform t;
+		Interpolate(time, &t);
+		return t(p);
+	}
+
+	Vec3f AnimatedTransform::operator()(float time, const Vec3f &v) const {
+		AffineTransform t;
+		Interpolate(time, &t);
+		return t(v);
+	}
+
+	static float LinearLength(const Matrix4x4 &m, const Point3f &p) {
+		return Vec3f(m.m[0][0] * p.x + m.m[0][1] * p.y + m.m[0][2] * p.z,
+			m.m[1][0] * p.x + m.m[1][1] * p.y + m.m[1][2] * p.z,
+			m.m[2][0] * p.x + m.m[2][1] * p.y + m.m[2][2] * p.z).Length();
+	}
+
+	BBox AnimatedTransform::MotionBounds(const BBox &b) const {
+		if (!mActuallyAnimated) return (*mStartTransform)(b);
+		// Without rotation every point moves linearly between the keyframes
+		if (!mHasRotation) return Union((*mStartTransform)(b), (*mEndTransform)(b));
+
+		// Bound on how far any point of b moves per unit of normalized time:
+		// translation, plus rotation of the scaled point, plus the change of
+		// scale. Each term is convex in the point, so its maximum over the box
+		// is found at a corner.
+		Matrix4x4 dS;
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				dS.m[i][j] = S[1].m[i][j] - S[0].m[i][j];
+		// Slerp turns at 2 theta, and the normalized lerp Slerp uses for
+		// nearly parallel quaternions peaks at 4 tan(theta / 2) mid-way. The
+		// latter bounds both and stays accurate for tiny angles, where acos of
+		// the dot product rounds to zero.
+		float angularSpeed = 4.f * std::sqrt(Dot(R[1] - R[0], R[1] - R[0]) / Dot(R[1] + R[0], R[1] + R[0]));
+		float speed = 0.f;
+		for (int c = 0; c < 8; ++c) {
+			Point3f p((c & 1) ? b.pMax.x : b.pMin.x, (c & 2) ? b.pMax.y : b.pMin.y, (c & 4) ? b.pMax.z : b.pMin.z);
+			float scaled = std::max(LinearLength(S[0], p), LinearLength(S[1], p));
+			speed = std::max(speed, angularSpeed * scaled + LinearLength(dS, p));
+		}
+		speed += (T[1] - T[0]).Length();
+
+		// Bounds at evenly spaced times, padded by the farthest a point can
+		// travel from its nearest sampled position
+		const int nSteps = 32;
+		BBox bounds;
+		for (int i = 0; i <= nSteps; ++i) {
+			AffineTransform t;
+			Interpolate(Lerp((float)i / (float)nSteps, mStartTime, mEndTime), &t);
+			bounds = Union(bounds, t(b));
+		}
+		bounds.Expand(speed * .5f / nSteps);
+		return bounds;
+	}
+
 	bool Transform::SwapsHandedness() const {
 		float det = ((m.m[0][0] *
 			(m.m[1][1] * m.m[2][2] -
@@ -1,9 +1,10 @@
 #ifndef TRANSFORM_H
-#define TRANSFROM_H
+#define TRANSFORM_H
 #include "Geometry.h"
 #include "Ray.h"
 #include "BBox.h"
 #include "Hebex.h"
+#include "Quaternion.h"
 
 namespace Hebex
 {
@@ -39,16 +40,8 @@ namespace Hebex
 
 		friend Matrix4x4 Transpose(const Matrix4x4 &);
 
-		static Matrix4x4 Mul(const Matrix4x4 &m1, const Matrix4x4 &m2) {
-			Matrix4x4 r;
-			for (int i = 0; i < 4; ++i)
-				for (int j = 0; j < 4; ++j)
-					r.m[i][j] = m1.m[i][0] * m2.m[0][j] +
-					m1.m[i][1] * m2.m[1][j] +
-					m1.m[i][2] * m2.m[2][j] +
-					m1.m[i][3] * m2.m[3][j];
-			return r;
-		}
+		// Rounds exactly like the scalar product on every backend
+		static Matrix4x4 Mul(const Matrix4x4 &m1, const Matrix4x4 &m2);
 
 		static Matrix4x4 Identity() {
 			return Matrix4x4();
@@ -72,6 +65,23 @@ namespace Hebex
 	};
 
 
+	// Implementations of Matrix4x4::Mul and Inverse. The fastest one the CPU
+	// supports is selected at startup. Scalar is the reference: a plain
+	// product and Gauss-Jordan elimination with full pivoting. The SIMD
+	// backends invert affine matrices in closed form and others by 2x2
+	// block cofactors, which agree with Scalar up to rounding.
+	enum class MatrixBackend { Scalar, SSE, AVX2 };
+
+	// Falls back to Scalar if the CPU lacks the instructions
+	void SetMatrixBackend(MatrixBackend backend);
+
+	MatrixBackend GetMatrixBackend();
+
+	// Last row is (0, 0, 0, 1)
+	inline bool IsAffine(const Matrix4x4 &m) {
+		return m.m[3][0] == 0.f && m.m[3][1] == 0.f && m.m[3][2] == 0.f && m.m[3][3] == 1.f;
+	}
+
 	class Transform {
 	public:
 		// Transform Public Methods
@@ -173,6 +183,176 @@ namespace Hebex
 		Matrix4x4 m, mInv;
 	};
 
+	// Top three rows of an affine matrix, whose last row is (0, 0, 0, 1)
+	struct Matrix3x4 {
+		Matrix3x4() {
+			for (int i = 0; i < 3; ++i)
+				for (int j = 0; j < 4; ++j)
+					m[i][j] = i == j ? 1.f : 0.f;
+		}
+
+		bool operator==(const Matrix3x4 &m2) const {
+			for (int i = 0; i < 3; ++i)
+				for (int j = 0; j < 4; ++j)
+					if (m[i][j] != m2.m[i][j]) return false;
+			return true;
+		}
+
+		float m[3][4];
+	};
+
+	// Transform of shapes and instances. Affine maps need no fourth row, so
+	// points are mapped without the homogeneous divide and the matrix and its
+	// inverse take 96 bytes instead of 128. Normals are mapped by the
+	// transpose of the stored inverse. Projective transforms, such as
+	// Perspective, remain Transforms.
+	class AffineTransform {
+	public:
+		AffineTransform() {}
+
+		// t must be affine
+		explicit AffineTransform(const Transform &t);
+
+		AffineTransform(const Matrix3x4 &mat, const Matrix3x4 &minv)
+			: m(mat), mInv(minv) {
+		}
+
+		friend AffineTransform Inverse(const AffineTransform &t) {
+			return AffineTransform(t.mInv, t.m);
+		}
+
+		bool operator==(const AffineTransform &t) const {
+			return t.m == m && t.mInv == mInv;
+		}
+
+		bool operator!=(const AffineTransform &t) const {
+			return !(*this == t);
+		}
+
+		bool IsIdentity() const {
+			return m == Matrix3x4();
+		}
+
+		const Matrix3x4 &GetMatrix() const { return m; }
+
+		const Matrix3x4 &GetInverseMatrix() const { return mInv; }
+
+		Transform ToTransform() const;
+
+		inline Point3f operator()(const Point3f &pt) const;
+
+		inline void operator()(const Point3f &pt, Point3f *ptrans) const;
+
+		inline Vec3f operator()(const Vec3f &v) const;
+
+		inline void operator()(const Vec3f &v, Vec3f *vt) const;
+
+		inline Normal3f operator()(const Normal3f &n) const;
+
+		inline Ray operator()(const Ray &r) const;
+
+		inline void operator()(const Ray &r, Ray *rt) const;
+
+		inline RayDifferential operator()(const RayDifferential &r) const;
+
+		BBox operator()(const BBox &b) const;
+
+		AffineTransform operator*(const AffineTransform &t2) const;
+
+		bool SwapsHandedness() const;
+
+		friend std::ostream &operator<<(std::ostream &os, const AffineTransform &t) {
+			return os << t.ToTransform();
+		}
+
+	private:
+		Matrix3x4 m, mInv;
+	};
+
+	// Inverse transpose of an affine transform's linear part, with contiguous
+	// rows. Objects that map many normals build it once instead of reading
+	// the transform's inverse column-wise for every normal.
+	struct NormalMatrix {
+		NormalMatrix() {
+			for (int i = 0; i < 3; ++i)
+				for (int j = 0; j < 3; ++j)
+					m[i][j] = i == j ? 1.f : 0.f;
+		}
+
+		explicit NormalMatrix(const AffineTransform &t);
+
+		Normal3f operator()(const Normal3f &n) const {
+			return Normal3f(m[0][0] * n.x + m[0][1] * n.y + m[0][2] * n.z,
+				m[1][0] * n.x + m[1][1] * n.y + m[1][2] * n.z,
+				m[2][0] * n.x + m[2][1] * n.y + m[2][2] * n.z);
+		}
+
+		// For normals and their derivatives stored as Vec3f
+		Vec3f operator()(const Vec3f &n) const {
+			return Vec3f(m[0][0] * n.x + m[0][1] * n.y + m[0][2] * n.z,
+				m[1][0] * n.x + m[1][1] * n.y + m[1][2] * n.z,
+				m[2][0] * n.x + m[2][1] * n.y + m[2][2] * n.z);
+		}
+
+		float m[3][3];
+	};
+
+	// Batched transforms of SoA component arrays, as stored by meshes. The
+	// outputs may alias the inputs. Runs 8 elements at a time with AVX2/FMA
+	// when available, and splits large arrays across the thread pool.
+	void TransformPoints(const AffineTransform &t, const float *x, const float *y, const float *z,
+		float *xt, float *yt, float *zt, size_t count);
+
+	void TransformVectors(const AffineTransform &t, const float *x, const float *y, const float *z,
+		float *xt, float *yt, float *zt, size_t count);
+
+	void TransformNormals(const NormalMatrix &nm, const float *nx, const float *ny, const float *nz,
+		float *ntx, float *nty, float *ntz, size_t count);
+
+	// Normals stored AoS; nt may alias n
+	void TransformNormals(const NormalMatrix &nm, const Normal3f *n, Normal3f *nt, size_t count);
+
+	// Transform moving between two affine keyframes over [startTime,
+	// endTime]. Each keyframe is decomposed into translation, rotation and
+	// scale, which are interpolated separately at the time of each ray, so
+	// rotations do not shear in between.
+	class AnimatedTransform {
+	public:
+		AnimatedTransform(const AffineTransform *startTransform, float startTime,
+			const AffineTransform *endTransform, float endTime);
+
+		// m = T R S, with R found by polar decomposition
+		static void Decompose(const Matrix4x4 &m, Vec3f *T, Quaternion *R, Matrix4x4 *S);
+
+		// Clamped to the keyframes outside [startTime, endTime]
+		void Interpolate(float time, AffineTransform *t) const;
+
+		// Maps the ray at its own mTime
+		Ray operator()(const Ray &r) const;
+
+		void operator()(const Ray &r, Ray *rt) const;
+
+		Point3f operator()(float time, const Point3f &p) const;
+
+		Vec3f operator()(float time, const Vec3f &v) const;
+
+		// Conservative bound of b over the whole time range
+		BBox MotionBounds(const BBox &b) const;
+
+		bool IsAnimated() const { return mActuallyAnimated; }
+
+		bool HasRotation() const { return mHasRotation; }
+
+	private:
+		const AffineTransform *mStartTransform, *mEndTransform;
+		const float mStartTime, mEndTime;
+		const bool mActuallyAnimated;
+		bool mHasRotation = false;
+		Vec3f T[2];
+		Quaternion R[2];
+		Matrix4x4 S[2];
+	};
+
 	Transform Translate(const Vec3f &delta);
 	Transform Scale(float x, float y, float z);
 	Transform RotateX(float angle);
@@ -256,6 +436,7 @@ namespace Hebex
 		if (rt != &r) {
 			rt->tMin = r.tMin;
 			rt->tMax = r.tMax;
+			rt->mTime = r.mTime;
 		}
 	}
 
@@ -280,6 +461,69 @@ namespace Hebex
 		return ret;
 	}
 
+	inline Point3f AffineTransform::operator()(const Point3f &pt) const {
+		float x = pt.x, y = pt.y, z = pt.z;
+		return Point3f(m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z + m.m[0][3],
+			m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z + m.m[1][3],
+			m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z + m.m[2][3]);
+	}
+
+	inline void AffineTransform::operator()(const Point3f &pt, Point3f *ptrans) const {
+		float x = pt.x, y = pt.y, z = pt.z;
+		ptrans->x = m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z + m.m[0][3];
+		ptrans->y = m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z + m.m[1][3];
+		ptrans->z = m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z + m.m[2][3];
+	}
+
+	inline Vec3f AffineTransform::operator()(const Vec3f &v) const {
+		float x = v.x, y = v.y, z = v.z;
+		return Vec3f(m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z,
+			m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z,
+			m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z);
+	}
+
+	inline void AffineTransform::operator()(const Vec3f &v, Vec3f *vt) const {
+		float x = v.x, y = v.y, z = v.z;
+		vt->x = m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z;
+		vt->y = m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z;
+		vt->z = m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z;
+	}
+
+	inline Normal3f AffineTransform::operator()(const Normal3f &n) const {
+		float x = n.x, y = n.y, z = n.z;
+		return Normal3f(mInv.m[0][0] * x + mInv.m[1][0] * y + mInv.m[2][0] * z,
+			mInv.m[0][1] * x + mInv.m[1][1] * y + mInv.m[2][1] * z,
+			mInv.m[0][2] * x + mInv.m[1][2] * y + mInv.m[2][2] * z);
+	}
+
+	inline Ray AffineTransform::operator()(const Ray &r) const {
+		Ray ret = r;
+		(*this)(ret.mOrigin, &ret.mOrigin);
+		(*this)(ret.mDirection, &ret.mDirection);
+		return ret;
+	}
+
+	inline void AffineTransform::operator()(const Ray &r, Ray *rt) const {
+		(*this)(r.mOrigin, &rt->mOrigin);
+		(*this)(r.mDirection, &rt->mDirection);
+		if (rt != &r) {
+			rt->tMin = r.tMin;
+			rt->tMax = r.tMax;
+			rt->mTime = r.mTime;
+		}
+	}
+
+	inline RayDifferential AffineTransform::operator()(const RayDifferential &r) const {
+		RayDifferential ret;
+		(*this)(Ray(r), (Ray*)(&ret));
+		ret.hasDifferentials = r.hasDifferentials;
+		(*this)(r.rxOrigin, &ret.rxOrigin);
+		(*this)(r.ryOrigin, &ret.ryOrigin);
+		(*this)(r.rxDirection, &ret.rxDirection);
+		(*this)(r.ryDirection, &ret.ryDirection);
+		return ret;
+	}
+
 }
 
 #endif
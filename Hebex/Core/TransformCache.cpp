@@ -0,0 +1,85 @@
+#include "TransformCache.h"
+#include "Transform.h"
+
+namespace Hebex
+{
+	TransformCache::TransformCache() : mPool(64 * sizeof(AffineTransform)), mHashTable(512, nullptr) {
+	}
+
+	uint64_t TransformCache::Hash(const AffineTransform &t) {
+		// MurmurHash64A over the 24 matrix entries. -0 is folded into +0 so
+		// that transforms equal under operator== hash alike.
+		const uint64_t mul = 0xc6a4a7935bd1e995ull;
+		const int r = 47;
+		const Matrix3x4 *mats[2] = { &t.GetMatrix(), &t.GetInverseMatrix() };
+		uint64_t h = 0x5bd1e995ull ^ (24 * sizeof(float) * mul);
+		for (const Matrix3x4 *mat : mats) {
+			for (int i = 0; i < 3; ++i) {
+				for (int j = 0; j < 4; j += 2) {
+					float f[2] = { mat->m[i][j] + 0.f, mat->m[i][j + 1] + 0.f };
+					uint64_t k;
+					memcpy(&k, f, sizeof(k));
+					k *= mul;
+					k ^= k >> r;
+					k *= mul;
+					h ^= k;
+					h *= mul;
+				}
+			}
+		}
+		h ^= h >> r;
+		h *= mul;
+		h ^= h >> r;
+		return h;
+	}
+
+	const AffineTransform *TransformCache::Lookup(const AffineTransform &t) {
+		++mLookups;
+		size_t mask = mHashTable.size() - 1;
+		size_t offset = Hash(t) & mask;
+		while (const AffineTransform *entry = mHashTable[offset]) {
+			if (*entry == t) {
+				++mHits;
+				return entry;
+			}
+			offset = (offset + 1) & mask;
+		}
+
+		AffineTransform *tCached = new (mPool.Alloc(sizeof(AffineTransform))) AffineTransform(t);
+		mHashTable[offset] = tCached;
+		if (++mTableOccupancy * 2 > mHashTable.size()) Grow();
+		return tCached;
+	}
+
+	void TransformCache::Lookup(const AffineTransform &t, const AffineTransform **tCached, const AffineTransform **tCachedInverse) {
+		*tCached = Lookup(t);
+		*tCachedInverse = Lookup(Inverse(t));
+	}
+
+	void TransformCache::Insert(const AffineTransform *t) {
+		size_t mask = mHashTable.size() - 1;
+		size_t offset = Hash(*t) & mask;
+		while (mHashTable[offset]) offset = (offset + 1) & mask;
+		mHashTable[offset] = t;
+	}
+
+	void TransformCache::Grow() {
+		std::vector<const AffineTransform *> oldTable;
+		oldTable.swap(mHashTable);
+		mHashTable.assign(2 * oldTable.size(), nullptr);
+		for (const AffineTransform *t : oldTable)
+			if (t) Insert(t);
+	}
+
+	void TransformCache::Clear() {
+		// AffineTransform is trivially destructible, the pool can simply be reused
+		mPool.Reset();
+		std::fill(mHashTable.begin(), mHashTable.end(), nullptr);
+		mTableOccupancy = 0;
+		mLookups = mHits = 0;
+	}
+
+	size_t TransformCache::BytesUsed() const {
+		return mPool.TotalAllocated() + mHashTable.size() * sizeof(mHashTable[0]);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef TRANSFORMCACHE_H
+#define TRANSFORMCACHE_H
+
+#include "../ForwardDecl.h"
+#include "Hebex.h"
+#include "MemoryPool.h"
+
+namespace Hebex
+{
+	// Interns transforms for scene construction: equal transforms share one
+	// copy allocated from a pool, so shapes can keep the returned pointers
+	// for the cache's lifetime. Open addressing with linear probing over a
+	// power-of-two table. Not thread safe.
+	class TransformCache {
+	public:
+		TransformCache();
+
+		// The shared copy of t
+		const AffineTransform *Lookup(const AffineTransform &t);
+
+		// Shared copies of t and its inverse, as shapes take them
+		void Lookup(const AffineTransform &t, const AffineTransform **tCached, const AffineTransform **tCachedInverse);
+
+		// Invalidates every pointer handed out
+		void Clear();
+
+		size_t Size() const { return mTableOccupancy; }
+
+		uint64_t GetLookups() const { return mLookups; }
+
+		uint64_t GetHits() const { return mHits; }
+
+		float HitRate() const { return mLookups ? (float)mHits / (float)mLookups : 0.f; }
+
+		// Pool and table memory
+		size_t BytesUsed() const;
+
+	private:
+		TransformCache(const TransformCache &) = delete;
+		TransformCache &operator=(const TransformCache &) = delete;
+
+		static uint64_t Hash(const AffineTransform &t);
+
+		void Insert(const AffineTransform *t);
+
+		void Grow();
+
+		MemoryPool mPool;
+		std::vector<const AffineTransform *> mHashTable;
+		size_t mTableOccupancy = 0;
+		uint64_t mLookups = 0, mHits = 0;
+	};
+}
+
+#endif
@@ -14,6 +14,14 @@ namespace Hebex
 	const float TWO_PI = 6.28318530718f;
 	const float INV_PI = 0.31830988618379067154f;
 	const float INV_TWOPI = 0.15915494309189533577f;
+	constexpr float MachineEpsilon = FLT_EPSILON * .5f;
+	// Largest float below one
+	constexpr float OneMinusEpsilon = 1.f - MachineEpsilon;
+
+	// Bound on the relative error of n chained float operations
+	inline constexpr float Gamma(int n) {
+		return (n * MachineEpsilon) / (1 - n * MachineEpsilon);
+	}
 
 
 	inline bool IsEqual(float a, float b, const float epsilon = 1e-7f) {
@@ -31,6 +39,27 @@ namespace Hebex
 	}
 
 
+	inline int Log2Int(uint32_t v) {
+#if defined(_MSC_VER)
+		unsigned long lz = 0;
+		_BitScanReverse(&lz, v);
+		return lz;
+#else
+		return 31 - __builtin_clz(v);
+#endif
+	}
+
+	// Spreads the low 21 bits of x so that two zero bits follow each one
+	inline uint64_t LeftShift3(uint64_t x) {
+		x &= 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffff;
+		x = (x | x << 16) & 0x1f0000ff0000ff;
+		x = (x | x << 8) & 0x100f00f00f00f00f;
+		x = (x | x << 4) & 0x10c30c30c30c30c3;
+		x = (x | x << 2) & 0x1249249249249249;
+		return x;
+	}
+
 	inline float Log2(float n) {
 		static float invLog2 = 1.0f / logf(2.0f);
 		return std::logf(n) * invLog2;
@@ -22,15 +22,25 @@ namespace Hebex
 	typedef Point3<float> Point3f;
 	typedef Point3<int> Point3i;
 	class Transform;
+	class AffineTransform;
+	class AnimatedTransform;
+	struct Quaternion;
+	class TransformCache;
 	class BBox;
 	class Medium;
 	class Ray;
+	class RayDifferential;
+	class RayBatch;
+	class CacheSimulator;
 	class Color;
 	class MemoryPool;
+	template <typename T>
+	class ObjectPool;
 	class Primitive;
 	class BSDF;
 	class BSSRDF;
 	class Intersection;
+	struct SurfaceHit;
 	class Shape;
 }
 
@@ -0,0 +1,851 @@
+#include "MeshLoader.h"
+#include "../Core/Transform.h"
+#include "../Core/MappedFile.h"
+#include "../Core/Parallel.h"
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+
+namespace Hebex
+{
+	// Vertices or faces handed to one ParallelFor work item
+	static const int64_t loadChunkSize = 65536;
+
+	// Bytes of OBJ text per work item, before moving the split to a line end
+	static const size_t objChunkBytes = 1 << 20;
+
+	static void MeshError(const std::string &filename, const char *message) {
+		std::cerr << "Error: " << filename << ": " << message << std::endl;
+	}
+
+	// Stores object-space vertices as they are parsed; ToWorld then maps
+	// them all with the batched transforms
+	struct VertexWriter {
+		VertexWriter(TriangleMesh *mesh, const AffineTransform *o2w) :
+			mesh(mesh), o2w(*o2w) {
+			for (int axis = 0; axis < 3; ++axis) {
+				P[axis] = mesh->GetPositionArray(axis);
+				N[axis] = mesh->HasNormals() ? mesh->GetNormalArray(axis) : nullptr;
+			}
+			for (int i = 0; i < 2; ++i)
+				UV[i] = mesh->HasUV() ? mesh->GetUVArray(i) : nullptr;
+		}
+
+		void Position(int64_t i, float x, float y, float z) const {
+			P[0][i] = x;
+			P[1][i] = y;
+			P[2][i] = z;
+		}
+
+		void Normal(int64_t i, float x, float y, float z) const {
+			N[0][i] = x;
+			N[1][i] = y;
+			N[2][i] = z;
+		}
+
+		void TexCoord(int64_t i, float u, float v) const {
+			UV[0][i] = u;
+			UV[1][i] = v;
+		}
+
+		void ToWorld() const {
+			if (o2w.IsIdentity()) return;
+			size_t n = mesh->GetVertexCount();
+			TransformPoints(o2w, P[0], P[1], P[2], P[0], P[1], P[2], n);
+			if (mesh->HasNormals())
+				TransformNormals(NormalMatrix(o2w), N[0], N[1], N[2], N[0], N[1], N[2], n);
+		}
+
+		TriangleMesh *mesh;
+		const AffineTransform &o2w;
+		float *P[3], *N[3], *UV[2];
+	};
+
+	// ----------------------------------------------------------------------
+	// PLY
+
+	enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+	static const int plyTypeSize[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+	static PlyType ParsePlyType(const std::string &name) {
+		if (name == "char" || name == "int8") return PlyType::Int8;
+		if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+		if (name == "short" || name == "int16") return PlyType::Int16;
+		if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+		if (name == "int" || name == "int32") return PlyType::Int32;
+		if (name == "uint" || name == "uint32") return PlyType::UInt32;
+		if (name == "float" || name == "float32") return PlyType::Float32;
+		if (name == "double" || name == "float64") return PlyType::Float64;
+		return PlyType::Invalid;
+	}
+
+	struct PlyProperty {
+		std::string name;
+		PlyType type;
+		PlyType countType;  // Invalid unless this is a list
+		int offset;         // inside the record, for properties before the first list
+	};
+
+	struct PlyElement {
+		std::string name;
+		int64_t count;
+		std::vector<PlyProperty> properties;
+		int fixedSize;      // record size, or -1 if the element has a list
+	};
+
+	template <typename T>
+	inline T ReadPly(const char *p, bool swap) {
+		char bytes[sizeof(T)];
+		memcpy(bytes, p, sizeof(T));
+		if (swap) std::reverse(bytes, bytes + sizeof(T));
+		T value;
+		memcpy(&value, bytes, sizeof(T));
+		return value;
+	}
+
+	static double ReadPlyScalar(const char *p, PlyType type, bool swap) {
+		switch (type) {
+		case PlyType::Int8: return *(const int8_t *)p;
+		case PlyType::UInt8: return *(const uint8_t *)p;
+		case PlyType::Int16: return ReadPly<int16_t>(p, swap);
+		case PlyType::UInt16: return ReadPly<uint16_t>(p, swap);
+		case PlyType::Int32: return ReadPly<int32_t>(p, swap);
+		case PlyType::UInt32: return ReadPly<uint32_t>(p, swap);
+		case PlyType::Float32: return ReadPly<float>(p, swap);
+		case PlyType::Float64: return ReadPly<double>(p, swap);
+		default: return 0.;
+		}
+	}
+
+	static int64_t ReadPlyInteger(const char *p, PlyType type, bool swap) {
+		switch (type) {
+		case PlyType::Int8: return *(const int8_t *)p;
+		case PlyType::UInt8: return *(const uint8_t *)p;
+		case PlyType::Int16: return ReadPly<int16_t>(p, swap);
+		case PlyType::UInt16: return ReadPly<uint16_t>(p, swap);
+		case PlyType::Int32: return ReadPly<int32_t>(p, swap);
+		case PlyType::UInt32: return ReadPly<uint32_t>(p, swap);
+		default: return (int64_t)ReadPlyScalar(p, type, swap);
+		}
+	}
+
+	// Size of one record starting at p, for elements with lists. Fails if
+	// the record does not fit before end or has a negative list count.
+	static bool PlyRecordSize(const PlyElement &element, const char *p, const char *end,
+		bool swap, size_t *recordSize) {
+		size_t size = 0, avail = end - p;
+		for (const PlyProperty &prop : element.properties) {
+			if (prop.countType == PlyType::Invalid)
+				size += plyTypeSize[(int)prop.type];
+			else {
+				size_t countSize = plyTypeSize[(int)prop.countType];
+				if (size + countSize > avail) return false;
+				int64_t n = ReadPlyInteger(p + size, prop.countType, swap);
+				size += countSize;
+				if (n < 0 || (uint64_t)n > (avail - size) / plyTypeSize[(int)prop.type]) return false;
+				size += n * plyTypeSize[(int)prop.type];
+			}
+			if (size > avail) return false;
+		}
+		*recordSize = size;
+		return true;
+	}
+
+	// Element count from the header; strtoll instead of std::stoll so that
+	// a malformed file is reported and does not throw
+	static bool ParsePlyCount(const std::string &token, int64_t *count) {
+		if (token.empty() || !isdigit((unsigned char)token[0])) return false;
+		errno = 0;
+		char *stop = nullptr;
+		long long value = strtoll(token.c_str(), &stop, 10);
+		if (errno == ERANGE || *stop != '\0') return false;
+		*count = value;
+		return true;
+	}
+
+	static bool ParsePlyHeader(const char *data, size_t size, std::vector<PlyElement> *elements,
+		bool *swap, size_t *headerSize, const char **error) {
+		const char *p = data, *end = data + size;
+		bool first = true, hasFormat = false;
+		while (true) {
+			const char *eol = (const char *)memchr(p, '\n', end - p);
+			if (!eol) {
+				*error = "truncated header";
+				return false;
+			}
+			std::string line(p, eol - p);
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			p = eol + 1;
+
+			std::vector<std::string> tokens;
+			size_t pos = 0;
+			while (pos < line.size()) {
+				size_t start = line.find_first_not_of(" \t", pos);
+				if (start == std::string::npos) break;
+				size_t stop = line.find_first_of(" \t", start);
+				if (stop == std::string::npos) stop = line.size();
+				tokens.push_back(line.substr(start, stop - start));
+				pos = stop;
+			}
+
+			if (first) {
+				if (tokens.size() != 1 || tokens[0] != "ply") {
+					*error = "not a PLY file";
+					return false;
+				}
+				first = false;
+			}
+			else if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+				continue;
+			else if (tokens[0] == "format" && tokens.size() >= 2) {
+				if (tokens[1] == "binary_little_endian" || tokens[1] == "binary_big_endian") {
+					const uint16_t one = 1;
+					bool littleEndianHost = *(const uint8_t *)&one == 1;
+					*swap = (tokens[1] == "binary_little_endian") != littleEndianHost;
+					hasFormat = true;
+				}
+				else {
+					*error = "only binary PLY files are supported";
+					return false;
+				}
+			}
+			else if (tokens[0] == "element" && tokens.size() == 3) {
+				PlyElement element;
+				element.name = tokens[1];
+				if (!ParsePlyCount(tokens[2], &element.count)) {
+					*error = "bad element count";
+					return false;
+				}
+				element.fixedSize = 0;
+				elements->push_back(element);
+			}
+			else if (tokens[0] == "property" && !elements->empty()) {
+				PlyElement &element = elements->back();
+				PlyProperty prop;
+				if (tokens.size() == 5 && tokens[1] == "list") {
+					prop.countType = ParsePlyType(tokens[2]);
+					prop.type = ParsePlyType(tokens[3]);
+					prop.name = tokens[4];
+					if (prop.countType == PlyType::Invalid || prop.countType == PlyType::Float32 ||
+						prop.countType == PlyType::Float64) {
+						*error = "bad list count type";
+						return false;
+					}
+				}
+				else if (tokens.size() == 3) {
+					prop.countType = PlyType::Invalid;
+					prop.type = ParsePlyType(tokens[1]);
+					prop.name = tokens[2];
+				}
+				else {
+					*error = "bad property";
+					return false;
+				}
+				if (prop.type == PlyType::Invalid) {
+					*error = "unknown property type";
+					return false;
+				}
+				prop.offset = element.fixedSize;
+				if (element.fixedSize >= 0)
+					element.fixedSize = prop.countType == PlyType::Invalid ?
+						element.fixedSize + plyTypeSize[(int)prop.type] : -1;
+				element.properties.push_back(prop);
+			}
+			else if (tokens[0] == "end_header")
+				break;
+		}
+		if (!hasFormat) {
+			*error = "missing format";
+			return false;
+		}
+		*headerSize = p - data;
+		return true;
+	}
+
+	static const PlyProperty *FindPlyProperty(const PlyElement &element, const char *name) {
+		for (const PlyProperty &prop : element.properties)
+			if (prop.name == name && prop.countType == PlyType::Invalid) return &prop;
+		return nullptr;
+	}
+
+	std::shared_ptr<TriangleMesh> LoadPLY(const std::string &filename, const AffineTransform *o2w, const AffineTransform *w2o) {
+		MappedFile file(filename);
+		if (!file.IsOpen()) {
+			MeshError(filename, "can't open file");
+			return nullptr;
+		}
+
+		std::vector<PlyElement> elements;
+		bool swap = false;
+		size_t headerSize = 0;
+		const char *error = nullptr;
+		if (!ParsePlyHeader(file.Data(), file.Size(), &elements, &swap, &headerSize, &error)) {
+			MeshError(filename, error);
+			return nullptr;
+		}
+
+		// Locate the vertex and face data; only elements with lists other
+		// than the last one need a sequential walk over their records
+		const char *data = file.Data(), *end = file.Data() + file.Size();
+		const char *cursor = data + headerSize;
+		const PlyElement *vertexElement = nullptr, *faceElement = nullptr;
+		const char *vertexData = nullptr, *faceData = nullptr;
+		for (size_t e = 0; e < elements.size(); ++e) {
+			const PlyElement &element = elements[e];
+			if (element.name == "vertex") {
+				vertexElement = &element;
+				vertexData = cursor;
+			}
+			else if (element.name == "face") {
+				faceElement = &element;
+				faceData = cursor;
+			}
+			bool fits = true;
+			if (element.fixedSize > 0) {
+				fits = element.count <= (end - cursor) / element.fixedSize;
+				if (fits) cursor += element.count * element.fixedSize;
+			}
+			else if (element.fixedSize < 0 && e + 1 < elements.size()) {
+				for (int64_t i = 0; i < element.count && fits; ++i) {
+					size_t recordSize;
+					fits = PlyRecordSize(element, cursor, end, swap, &recordSize);
+					if (fits) cursor += recordSize;
+				}
+			}
+			else if (element.fixedSize < 0)
+				cursor = end;
+			if (!fits) {
+				MeshError(filename, "truncated data");
+				return nullptr;
+			}
+		}
+		if (!vertexElement || !faceElement || vertexElement->fixedSize < 0) {
+			MeshError(filename, "missing vertex or face element");
+			return nullptr;
+		}
+
+		const PlyProperty *x = FindPlyProperty(*vertexElement, "x");
+		const PlyProperty *y = FindPlyProperty(*vertexElement, "y");
+		const PlyProperty *z = FindPlyProperty(*vertexElement, "z");
+		if (!x || !y || !z) {
+			MeshError(filename, "vertex element without x, y, z");
+			return nullptr;
+		}
+		const PlyProperty *nx = FindPlyProperty(*vertexElement, "nx");
+		const PlyProperty *ny = FindPlyProperty(*vertexElement, "ny");
+		const PlyProperty *nz = FindPlyProperty(*vertexElement, "nz");
+		bool hasNormals = nx && ny && nz;
+		const char *uNames[] = { "u", "s", "texture_u", "texture_s" };
+		const char *vNames[] = { "v", "t", "texture_v", "texture_t" };
+		const PlyProperty *u = nullptr, *v = nullptr;
+		for (int i = 0; i < 4 && !(u && v); ++i) {
+			u = FindPlyProperty(*vertexElement, uNames[i]);
+			v = FindPlyProperty(*vertexElement, vNames[i]);
+		}
+		bool hasUV = u && v;
+
+		// Face layout: scalar properties are skipped, the index list is fan
+		// triangulated
+		int listIndex = -1, nLists = 0;
+		for (size_t i = 0; i < faceElement->properties.size(); ++i) {
+			const PlyProperty &prop = faceElement->properties[i];
+			if (prop.countType == PlyType::Invalid) continue;
+			++nLists;
+			if (prop.name == "vertex_indices" || prop.name == "vertex_index") listIndex = (int)i;
+		}
+		if (listIndex < 0 || nLists != 1) {
+			MeshError(filename, "face element needs exactly one vertex_indices list");
+			return nullptr;
+		}
+		const PlyProperty &list = faceElement->properties[listIndex];
+		const int countSize = plyTypeSize[(int)list.countType];
+		const int indexSize = plyTypeSize[(int)list.type];
+		int scalarsBefore = 0, scalarsAfter = 0;
+		for (size_t i = 0; i < faceElement->properties.size(); ++i)
+			if ((int)i != listIndex)
+				((int)i < listIndex ? scalarsBefore : scalarsAfter) += plyTypeSize[(int)faceElement->properties[i].type];
+
+		const int64_t nVertices = vertexElement->count, nFaces = faceElement->count;
+		if (nVertices > INT32_MAX) {
+			MeshError(filename, "too many vertices");
+			return nullptr;
+		}
+		// Every face record holds at least its scalars and list count
+		if (nFaces > int64_t((end - faceData) / (scalarsBefore + countSize + scalarsAfter))) {
+			MeshError(filename, "truncated face data");
+			return nullptr;
+		}
+		const int64_t nFaceChunks = (nFaces + loadChunkSize - 1) / loadChunkSize;
+
+		// Most files hold only triangles, which makes every face record the
+		// same size. That is checked in parallel; otherwise one sequential pass
+		// over the counts finds where each chunk of faces starts.
+		const size_t triRecordSize = scalarsBefore + countSize + 3 * indexSize + scalarsAfter;
+		bool allTriangles = nFaces <= int64_t((end - faceData) / triRecordSize);
+		if (allTriangles) {
+			std::atomic<bool> triangles(true);
+			ParallelFor([&](int64_t chunk) {
+				int64_t start = chunk * loadChunkSize, stop = std::min(start + loadChunkSize, nFaces);
+				for (int64_t f = start; f < stop; ++f)
+					if (ReadPlyInteger(faceData + f * triRecordSize + scalarsBefore, list.countType, swap) != 3) {
+						triangles = false;
+						return;
+					}
+			}, nFaceChunks);
+			allTriangles = triangles;
+		}
+
+		std::vector<const char *> chunkData(nFaceChunks + 1);
+		std::vector<int64_t> chunkTriangles(nFaceChunks + 1);
+		if (allTriangles) {
+			for (int64_t c = 0; c <= nFaceChunks; ++c) {
+				int64_t f = std::min(c * loadChunkSize, nFaces);
+				chunkData[c] = faceData + f * triRecordSize;
+				chunkTriangles[c] = f;
+			}
+		}
+		else {
+			const char *p = faceData;
+			int64_t nTriangles = 0;
+			for (int64_t f = 0; f < nFaces; ++f) {
+				if (f % loadChunkSize == 0) {
+					chunkData[f / loadChunkSize] = p;
+					chunkTriangles[f / loadChunkSize] = nTriangles;
+				}
+				if (p + scalarsBefore + countSize > end) {
+					MeshError(filename, "truncated face data");
+					return nullptr;
+				}
+				int64_t n = ReadPlyInteger(p + scalarsBefore, list.countType, swap);
+				p += scalarsBefore + countSize;
+				if (n < 0) {
+					MeshError(filename, "negative face vertex count");
+					return nullptr;
+				}
+				if ((uint64_t)n > (size_t)(end - p) / indexSize ||
+					(size_t)(end - p) - n * indexSize < (size_t)scalarsAfter) {
+					MeshError(filename, "truncated face data");
+					return nullptr;
+				}
+				nTriangles += std::max<int64_t>(0, n - 2);
+				p += n * indexSize + scalarsAfter;
+			}
+			chunkData[nFaceChunks] = p;
+			chunkTriangles[nFaceChunks] = nTriangles;
+		}
+		const int64_t nTriangles = chunkTriangles[nFaceChunks];
+		if (nTriangles > INT32_MAX / 3) {
+			MeshError(filename, "too many triangles");
+			return nullptr;
+		}
+
+		std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(o2w, w2o,
+			(int)nTriangles, (int)nVertices, hasNormals, hasUV);
+		VertexWriter writer(mesh.get(), o2w);
+		const int vertexSize = vertexElement->fixedSize;
+		ParallelFor([&](int64_t chunk) {
+			int64_t start = chunk * loadChunkSize, stop = std::min(start + loadChunkSize, nVertices);
+			for (int64_t i = start; i < stop; ++i) {
+				const char *record = vertexData + i * vertexSize;
+				writer.Position(i, (float)ReadPlyScalar(record + x->offset, x->type, swap),
+					(float)ReadPlyScalar(record + y->offset, y->type, swap),
+					(float)ReadPlyScalar(record + z->offset, z->type, swap));
+				if (hasNormals)
+					writer.Normal(i, (float)ReadPlyScalar(record + nx->offset, nx->type, swap),
+						(float)ReadPlyScalar(record + ny->offset, ny->type, swap),
+						(float)ReadPlyScalar(record + nz->offset, nz->type, swap));
+				if (hasUV)
+					writer.TexCoord(i, (float)ReadPlyScalar(record + u->offset, u->type, swap),
+						(float)ReadPlyScalar(record + v->offset, v->type, swap));
+			}
+		}, (nVertices + loadChunkSize - 1) / loadChunkSize);
+
+		std::atomic<bool> badIndex(false);
+		int *indices = mesh->GetIndexArray();
+		ParallelFor([&](int64_t chunk) {
+			int64_t start = chunk * loadChunkSize, stop = std::min(start + loadChunkSize, nFaces);
+			const char *p = chunkData[chunk];
+			int *out = indices + 3 * chunkTriangles[chunk];
+			for (int64_t f = start; f < stop; ++f) {
+				p += scalarsBefore;
+				int64_t n = ReadPlyInteger(p, list.countType, swap);
+				p += countSize;
+				// Both passes above checked that n >= 0 and the list fits
+				int64_t v0 = 0, vPrev = 0;
+				for (int64_t k = 0; k < n; ++k) {
+					int64_t vk = ReadPlyInteger(p + k * indexSize, list.type, swap);
+					if (vk < 0 || vk >= nVertices) badIndex = true;
+					if (k == 0) v0 = vk;
+					if (k >= 2) {
+						out[0] = (int)v0;
+						out[1] = (int)vPrev;
+						out[2] = (int)vk;
+						out += 3;
+					}
+					vPrev = vk;
+				}
+				p += n * indexSize + scalarsAfter;
+			}
+		}, nFaceChunks);
+		if (badIndex) {
+			MeshError(filename, "vertex index out of range");
+			return nullptr;
+		}
+		writer.ToWorld();
+		return mesh;
+	}
+
+	// ----------------------------------------------------------------------
+	// OBJ
+
+	static inline bool IsBlank(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static inline const char *SkipBlanks(const char *p, const char *end) {
+		while (p < end && IsBlank(*p)) ++p;
+		return p;
+	}
+
+	static inline const char *NextLine(const char *p, const char *end) {
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		return eol ? eol + 1 : end;
+	}
+
+	static const char *ParseInt(const char *p, const char *end, int64_t *value) {
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+		int64_t v = 0;
+		while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+		*value = negative ? -v : v;
+		return p;
+	}
+
+	// Text is not null terminated inside the mapping, so strtof can't be used
+	static const char *ParseFloat(const char *p, const char *end, float *value) {
+		static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+		uint64_t mantissa = 0;
+		int exponent = 0, digits = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); ++digits; }
+			else ++exponent;
+		}
+		if (p < end && *p == '.') {
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+				if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); ++digits; --exponent; }
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			int64_t e;
+			p = ParseInt(p + 1, end, &e);
+			exponent += (int)std::max<int64_t>(-400, std::min<int64_t>(400, e));
+		}
+		double v = (double)mantissa;
+		if (exponent < 0)
+			v = exponent >= -22 ? v / powersOf10[-exponent] : v * std::pow(10., exponent);
+		else if (exponent > 0)
+			v = exponent <= 22 ? v * powersOf10[exponent] : v * std::pow(10., exponent);
+		*value = float(negative ? -v : v);
+		return p;
+	}
+
+	// One face corner; vt and vn are 0 when absent
+	struct ObjCorner {
+		int64_t v, vt, vn;
+	};
+
+	// Calls the handler for every statement of [begin, end), which starts and
+	// ends on line boundaries
+	template <typename Handler>
+	static void ParseOBJChunk(const char *begin, const char *end, Handler &handler) {
+		std::vector<ObjCorner> corners;
+		for (const char *p = begin; p < end; p = NextLine(p, end)) {
+			p = SkipBlanks(p, end);
+			if (end - p < 2) continue;
+			if (p[0] == 'v' && IsBlank(p[1])) {
+				float xyz[3];
+				p += 2;
+				for (int i = 0; i < 3; ++i) p = ParseFloat(SkipBlanks(p, end), end, &xyz[i]);
+				handler.Vertex(xyz);
+			}
+			else if (p[0] == 'v' && p[1] == 't' && end - p > 2 && IsBlank(p[2])) {
+				float uv[2];
+				p += 3;
+				for (int i = 0; i < 2; ++i) p = ParseFloat(SkipBlanks(p, end), end, &uv[i]);
+				handler.TexCoord(uv);
+			}
+			else if (p[0] == 'v' && p[1] == 'n' && end - p > 2 && IsBlank(p[2])) {
+				float n[3];
+				p += 3;
+				for (int i = 0; i < 3; ++i) p = ParseFloat(SkipBlanks(p, end), end, &n[i]);
+				handler.Normal(n);
+			}
+			else if (p[0] == 'f' && IsBlank(p[1])) {
+				corners.clear();
+				p += 2;
+				while (true) {
+					p = SkipBlanks(p, end);
+					if (p == end || *p == '\n' || *p == '#') break;
+					ObjCorner c = { 0, 0, 0 };
+					const char *start = p;
+					p = ParseInt(p, end, &c.v);
+					if (p < end && *p == '/') {
+						++p;
+						if (p < end && *p != '/') p = ParseInt(p, end, &c.vt);
+						if (p < end && *p == '/') p = ParseInt(p + 1, end, &c.vn);
+					}
+					// Anything unparsable ends the corner list
+					if (p == start) break;
+					corners.push_back(c);
+				}
+				handler.Face(corners);
+			}
+		}
+	}
+
+	struct ObjCounter {
+		void Vertex(const float *) { ++nV; }
+
+		void TexCoord(const float *) { ++nVt; }
+
+		void Normal(const float *) { ++nVn; }
+
+		void Face(const std::vector<ObjCorner> &corners) {
+			if (corners.size() < 3) return;
+			nTriangles += corners.size() - 2;
+			// Welding keeps the file's vertices only if every attribute of a
+			// corner uses the same, absolute, index
+			for (const ObjCorner &c : corners) {
+				if (c.v <= 0 || (c.vt && c.vt != c.v) || (c.vn && c.vn != c.v)) welded = false;
+				if (c.vt) anyVt = true; else allVt = false;
+				if (c.vn) anyVn = true; else allVn = false;
+			}
+		}
+
+		int64_t nV = 0, nVt = 0, nVn = 0, nTriangles = 0;
+		bool welded = true, anyVt = false, allVt = true, anyVn = false, allVn = true;
+	};
+
+	// Resolves 1-based and relative indices to 0-based ones
+	static inline int64_t ResolveObjIndex(int64_t index, int64_t countSoFar) {
+		return index > 0 ? index - 1 : countSoFar + index;
+	}
+
+	// Welded: file vertices become mesh vertices, corners index them directly
+	struct ObjWeldedWriter {
+		void Vertex(const float *p) { writer->Position(v++, p[0], p[1], p[2]); }
+
+		void TexCoord(const float *uv) {
+			if (writer->UV[0]) writer->TexCoord(vt, uv[0], uv[1]);
+			++vt;
+		}
+
+		void Normal(const float *n) {
+			if (writer->N[0]) writer->Normal(vn, n[0], n[1], n[2]);
+			++vn;
+		}
+
+		void Face(const std::vector<ObjCorner> &corners) {
+			for (size_t k = 0; k < corners.size(); ++k) {
+				int64_t index = ResolveObjIndex(corners[k].v, v);
+				if (index < 0 || index >= nVertices) bad = true;
+				if (k == 0) first = index;
+				if (k >= 2) {
+					out[0] = (int)first;
+					out[1] = (int)prev;
+					out[2] = (int)index;
+					out += 3;
+				}
+				prev = index;
+			}
+		}
+
+		const VertexWriter *writer;
+		int64_t nVertices;
+		int64_t v, vt, vn;  // running global counts
+		int *out;
+		int64_t first = 0, prev = 0;
+		bool bad = false;
+	};
+
+	// Unwelded, first pass: attributes go to object-space scratch arrays
+	struct ObjAttributeReader {
+		void Vertex(const float *p) { memcpy(&P[3 * v++], p, 3 * sizeof(float)); }
+
+		void TexCoord(const float *uv) { memcpy(&UV[2 * vt++], uv, 2 * sizeof(float)); }
+
+		void Normal(const float *n) { memcpy(&N[3 * vn++], n, 3 * sizeof(float)); }
+
+		void Face(const std::vector<ObjCorner> &) {}
+
+		float *P, *UV, *N;
+		int64_t v, vt, vn;
+	};
+
+	// Unwelded, second pass: every triangle corner becomes its own vertex
+	struct ObjUnweldedWriter {
+		void Vertex(const float *) { ++v; }
+
+		void TexCoord(const float *) { ++vt; }
+
+		void Normal(const float *) { ++vn; }
+
+		void Corner(int64_t out, const ObjCorner &c) {
+			int64_t iv = ResolveObjIndex(c.v, v);
+			if (iv < 0 || iv >= nV) {
+				bad = true;
+				return;
+			}
+			writer->Position(out, P[3 * iv], P[3 * iv + 1], P[3 * iv + 2]);
+			if (writer->UV[0]) {
+				int64_t it = ResolveObjIndex(c.vt, vt);
+				if (c.vt && it >= 0 && it < nVt) writer->TexCoord(out, UV[2 * it], UV[2 * it + 1]);
+				else writer->TexCoord(out, 0.f, 0.f);
+			}
+			if (writer->N[0]) {
+				int64_t in = ResolveObjIndex(c.vn, vn);
+				if (c.vn && in >= 0 && in < nVn) writer->Normal(out, N[3 * in], N[3 * in + 1], N[3 * in + 2]);
+				else writer->Normal(out, 0.f, 0.f, 0.f);
+			}
+		}
+
+		void Face(const std::vector<ObjCorner> &corners) {
+			for (size_t k = 2; k < corners.size(); ++k) {
+				Corner(3 * triangle, corners[0]);
+				Corner(3 * triangle + 1, corners[k - 1]);
+				Corner(3 * triangle + 2, corners[k]);
+				++triangle;
+			}
+		}
+
+		const VertexWriter *writer;
+		const float *P, *UV, *N;
+		int64_t nV, nVt, nVn;
+		int64_t v, vt, vn, triangle;
+		bool bad = false;
+	};
+
+	std::shared_ptr<TriangleMesh> LoadOBJ(const std::string &filename, const AffineTransform *o2w, const AffineTransform *w2o) {
+		MappedFile file(filename);
+		if (!file.IsOpen()) {
+			MeshError(filename, "can't open file");
+			return nullptr;
+		}
+
+		// Split the text into chunks that end on line boundaries
+		const char *data = file.Data(), *end = file.Data() + file.Size();
+		std::vector<const char *> chunkStart(1, data);
+		while (chunkStart.back() < end) {
+			const char *split = chunkStart.back() + std::min(objChunkBytes, size_t(end - chunkStart.back()));
+			chunkStart.push_back(split < end ? NextLine(split, end) : end);
+		}
+		const int64_t nChunks = chunkStart.size() - 1;
+
+		// First pass counts the statements of every chunk, giving each chunk
+		// its output offsets
+		std::vector<ObjCounter> counts(nChunks);
+		ParallelFor([&](int64_t c) {
+			ParseOBJChunk(chunkStart[c], chunkStart[c + 1], counts[c]);
+		}, nChunks);
+
+		ObjCounter total;
+		std::vector<ObjCounter> offsets(nChunks);
+		for (int64_t c = 0; c < nChunks; ++c) {
+			offsets[c] = total;
+			total.nV += counts[c].nV;
+			total.nVt += counts[c].nVt;
+			total.nVn += counts[c].nVn;
+			total.nTriangles += counts[c].nTriangles;
+			total.welded &= counts[c].welded;
+			total.anyVt |= counts[c].anyVt;
+			total.allVt &= counts[c].allVt;
+			total.anyVn |= counts[c].anyVn;
+			total.allVn &= counts[c].allVn;
+		}
+		if (total.nTriangles == 0) {
+			MeshError(filename, "no faces");
+			return nullptr;
+		}
+
+		bool welded = total.welded && (!total.anyVt || total.nVt == total.nV) &&
+			(!total.anyVn || total.nVn == total.nV);
+		bool hasUV = total.anyVt && total.allVt;
+		bool hasNormals = total.anyVn && total.allVn;
+		int64_t nVertices = welded ? total.nV : 3 * total.nTriangles;
+		if (nVertices > INT32_MAX || total.nTriangles > INT32_MAX / 3) {
+			MeshError(filename, "mesh too large");
+			return nullptr;
+		}
+
+		std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(o2w, w2o,
+			(int)total.nTriangles, (int)nVertices, hasNormals, hasUV);
+		VertexWriter writer(mesh.get(), o2w);
+		std::atomic<bool> bad(false);
+		if (welded) {
+			ParallelFor([&](int64_t c) {
+				ObjWeldedWriter chunkWriter;
+				chunkWriter.writer = &writer;
+				chunkWriter.nVertices = nVertices;
+				chunkWriter.v = offsets[c].nV;
+				chunkWriter.vt = offsets[c].nVt;
+				chunkWriter.vn = offsets[c].nVn;
+				chunkWriter.out = mesh->GetIndexArray() + 3 * offsets[c].nTriangles;
+				ParseOBJChunk(chunkStart[c], chunkStart[c + 1], chunkWriter);
+				if (chunkWriter.bad) bad = true;
+			}, nChunks);
+		}
+		else {
+			// Corners reference attributes anywhere earlier in the file, so
+			// they are gathered first
+			std::vector<float> P(3 * total.nV), UV(2 * total.nVt), N(3 * total.nVn);
+			ParallelFor([&](int64_t c) {
+				ObjAttributeReader reader;
+				reader.P = P.data();
+				reader.UV = UV.data();
+				reader.N = N.data();
+				reader.v = offsets[c].nV;
+				reader.vt = offsets[c].nVt;
+				reader.vn = offsets[c].nVn;
+				ParseOBJChunk(chunkStart[c], chunkStart[c + 1], reader);
+			}, nChunks);
+
+			int *indices = mesh->GetIndexArray();
+			for (int i = 0; i < 3 * total.nTriangles; ++i) indices[i] = i;
+			ParallelFor([&](int64_t c) {
+				ObjUnweldedWriter chunkWriter;
+				chunkWriter.writer = &writer;
+				chunkWriter.P = P.data();
+				chunkWriter.UV = UV.data();
+				chunkWriter.N = N.data();
+				chunkWriter.nV = total.nV;
+				chunkWriter.nVt = total.nVt;
+				chunkWriter.nVn = total.nVn;
+				chunkWriter.v = offsets[c].nV;
+				chunkWriter.vt = offsets[c].nVt;
+				chunkWriter.vn = offsets[c].nVn;
+				chunkWriter.triangle = offsets[c].nTriangles;
+				ParseOBJChunk(chunkStart[c], chunkStart[c + 1], chunkWriter);
+				if (chunkWriter.bad) bad = true;
+			}, nChunks);
+		}
+		if (bad) {
+			MeshError(filename, "vertex index out of range");
+			return nullptr;
+		}
+		writer.ToWorld();
+		return mesh;
+	}
+
+	std::shared_ptr<TriangleMesh> LoadMesh(const std::string &filename, const AffineTransform *o2w, const AffineTransform *w2o) {
+		size_t dot = filename.find_last_of('.');
+		std::string extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		if (extension == "ply") return LoadPLY(filename, o2w, w2o);
+		if (extension == "obj") return LoadOBJ(filename, o2w, w2o);
+		MeshError(filename, "unknown mesh format");
+		return nullptr;
+	}
+}
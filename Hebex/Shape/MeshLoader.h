@@ -0,0 +1,26 @@
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include "Triangle.h"
+
+namespace Hebex
+{
+	// Mesh loaders map the file and parse it in parallel chunks, writing
+	// world-space data straight into the TriangleMesh buffers. Polygons are
+	// triangulated as fans. They return nullptr, after printing the reason,
+	// on failure.
+
+	// Binary PLY, either byte order, with vertex properties x y z, optionally
+	// nx ny nz and u v (or s t, texture_u texture_v) of any scalar type
+	std::shared_ptr<TriangleMesh> LoadPLY(const std::string &filename, const AffineTransform *o2w, const AffineTransform *w2o);
+
+	// Wavefront OBJ: v, vt, vn and f statements; everything else is ignored.
+	// Faces whose vt/vn indices differ from their v index are unwelded into
+	// three vertices per triangle.
+	std::shared_ptr<TriangleMesh> LoadOBJ(const std::string &filename, const AffineTransform *o2w, const AffineTransform *w2o);
+
+	// Picks the loader from the file extension
+	std::shared_ptr<TriangleMesh> LoadMesh(const std::string &filename, const AffineTransform *o2w, const AffineTransform *w2o);
+}
+
+#endif
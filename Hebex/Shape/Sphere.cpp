@@ -2,37 +2,49 @@
 #include "../Core/Transform.h"
 #include "../Core/Intersection.h"
 #include "../Core/Sampling.h"
+#include "../Core/RayBatch.h"
+#include "../Core/Simd.h"
 
 namespace Hebex
 {
-	Sphere::Sphere(const Transform *o2w, const Transform *w2o, float rad) :
-		Shape(o2w, w2o), mRadius(rad) {
+	Sphere::Sphere(const AffineTransform *o2w, const AffineTransform *w2o, float rad) :
+		Shape(o2w, w2o), mRadius(rad), mNormalToWorld(*o2w) {
 	}
 
-	bool Sphere::Intersect(const Ray &ray, Intersection *isect) const {
+	bool Sphere::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
 		Ray r;
 		(*WorldToObject)(ray, &r);
 
 		//Compute qudratic sphere coefficients
 		float A = r.mDirection.x * r.mDirection.x + r.mDirection.y * r.mDirection.y + r.mDirection.z * r.mDirection.z;
 		float B = 2.f * (r.mDirection.x * r.mOrigin.x + r.mDirection.y * r.mOrigin.y + r.mDirection.z * r.mOrigin.z);
-		float C = r.mOrigin.x * r.mOrigin.x + r.mOrigin.y * r.mOrigin.y + ray.mOrigin.z * ray.mOrigin.z - mRadius * mRadius;
+		float C = r.mOrigin.x * r.mOrigin.x + r.mOrigin.y * r.mOrigin.y + r.mOrigin.z * r.mOrigin.z - mRadius * mRadius;
 
 		float t0, t1;
 		if (!Quadratic(A, B, C, &t0, &t1)) return false;
 
 		if (t0 > r.tMax || t1 < r.tMin) return false;
 
-		float tHit = t0;
+		float tShapeHit = t0;
 		if (t0 < r.tMin) {
-			tHit = t1;
-			if (tHit > ray.tMax) return false;
+			tShapeHit = t1;
+			if (tShapeHit > r.tMax) return false;
 		}
 
-		Point3f pHit = r(tHit);
+		hit->t = tShapeHit;
+		hit->u = hit->v = 0.f;
+		return true;
+	}
+
+	void Sphere::ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		// Recompute the hit point and project it back onto the surface
+		Ray r;
+		(*WorldToObject)(ray, &r);
+		Point3f pHit = r(hit.t);
+		pHit *= mRadius / Distance(pHit, Point3f(0, 0, 0));
 		if (pHit.x == 0.f && pHit.y == 0.f) pHit.x = 1e-5f * mRadius;
 		float phi = std::atan2f(pHit.y, pHit.x);
-		if (phi < 0.) phi += 2.f * INV_PI;
+		if (phi < 0.) phi += 2.f * PI;
 
 		float u = phi / mPhiMax;
 		float theta = std::acosf(Clamp(pHit.z / mRadius, -1.f, 1.f));
@@ -68,10 +80,9 @@ namespace Hebex
 
 		Vec3f normal = pHit - Point3f(0, 0, 0);
 
-		const Transform &o2w = *ObjectToWorld;
-		const Transform o2wN = TransformNormal(o2w);
-		*isect = std::move(Intersection(o2w(pHit), o2wN(normal), Vec2f(u, v), o2w(dpdu), o2w(dpdv), o2wN(dndu), o2wN(dndv)));
-		return true;
+		const AffineTransform &o2w = *ObjectToWorld;
+		*isect = std::move(Intersection(o2w(pHit), mNormalToWorld(normal), Vec2f(u, v), o2w(dpdu), o2w(dpdv),
+			mNormalToWorld(dndu), mNormalToWorld(dndv)));
 	}
 
 	bool Sphere::IntersectP(const Ray &ray) const {
@@ -81,7 +92,7 @@ namespace Hebex
 		//Compute qudratic sphere coefficients
 		float A = r.mDirection.x * r.mDirection.x + r.mDirection.y * r.mDirection.y + r.mDirection.z * r.mDirection.z;
 		float B = 2.f * (r.mDirection.x * r.mOrigin.x + r.mDirection.y * r.mOrigin.y + r.mDirection.z * r.mOrigin.z);
-		float C = r.mOrigin.x * r.mOrigin.x + r.mOrigin.y * r.mOrigin.y + ray.mOrigin.z * ray.mOrigin.z - mRadius * mRadius;
+		float C = r.mOrigin.x * r.mOrigin.x + r.mOrigin.y * r.mOrigin.y + r.mOrigin.z * r.mOrigin.z - mRadius * mRadius;
 
 		float t0, t1;
 		if (!Quadratic(A, B, C, &t0, &t1)) return false;
@@ -108,8 +119,7 @@ namespace Hebex
 
 	Point3f Sphere::Sample(const Point2f &u, Vec3f *normal) const {
 		Point3f p = Point3f(0, 0, 0) + mRadius * UniformSampleSphere(u);
-		Transform transformNormal = TransformNormal((*ObjectToWorld));
-		*normal = transformNormal(Vec3f(p.x, p.y, p.z));
+		*normal = mNormalToWorld(Vec3f(p.x, p.y, p.z));
 
 		return (*ObjectToWorld)(p);
 	}
@@ -129,8 +139,9 @@ namespace Hebex
 		//float thit, rayEpsilon;
 		Point3f pHit;
 		Intersection isect;
+		float tHit;
 		Ray ray(p, UniformSampleCone(u, cosThetaMax, wcX, wcY, wc), 1e-3f);
-		if (!Intersect(ray, &isect))
+		if (!Intersect(ray, &tHit, &isect))
 			pHit = isect.mPosition;
 		*normal = Vec3f(Normalize(pHit - pCenter));
 		return pHit;
@@ -146,4 +157,97 @@ namespace Hebex
 		float cosThetaMax = std::sqrtf(std::max(0.f, 1.f - sinThetaMax2));
 		return UniformConePdf(cosThetaMax);
 	}
-}
\ No newline at end of file
+
+	// Hit distance of an object-space ray; the 8-wide kernel below follows the
+	// same steps lane by lane
+	static bool SphereHitDistance(const Ray &r, float radius, float *tHit) {
+		float A = r.mDirection.x * r.mDirection.x + r.mDirection.y * r.mDirection.y + r.mDirection.z * r.mDirection.z;
+		float B = 2.f * (r.mDirection.x * r.mOrigin.x + r.mDirection.y * r.mOrigin.y + r.mDirection.z * r.mOrigin.z);
+		float C = r.mOrigin.x * r.mOrigin.x + r.mOrigin.y * r.mOrigin.y + r.mOrigin.z * r.mOrigin.z - radius * radius;
+
+		float t0, t1;
+		if (!Quadratic(A, B, C, &t0, &t1)) return false;
+		if (t0 > r.tMax || t1 < r.tMin) return false;
+
+		*tHit = t0;
+		if (t0 < r.tMin) {
+			*tHit = t1;
+			if (*tHit > r.tMax) return false;
+		}
+		return true;
+	}
+
+	// Rays [start, start + 8) of the batch against a sphere, given its world
+	// to object matrix
+	HEBEX_TARGET_AVX2
+	static void IntersectSphere8(const Matrix3x4 &w2o, float radius, const RayBatch &rays, int start,
+		float *tHit, uint8_t *hit) {
+		const float (*m)[4] = w2o.m;
+		__m256 ox = _mm256_load_ps(rays.mOriginX + start);
+		__m256 oy = _mm256_load_ps(rays.mOriginY + start);
+		__m256 oz = _mm256_load_ps(rays.mOriginZ + start);
+		__m256 dx = _mm256_load_ps(rays.mDirectionX + start);
+		__m256 dy = _mm256_load_ps(rays.mDirectionY + start);
+		__m256 dz = _mm256_load_ps(rays.mDirectionZ + start);
+
+		// Transform to object space
+		__m256 o[3], d[3];
+		for (int i = 0; i < 3; ++i) {
+			__m256 mx = _mm256_set1_ps(m[i][0]);
+			__m256 my = _mm256_set1_ps(m[i][1]);
+			__m256 mz = _mm256_set1_ps(m[i][2]);
+			o[i] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, ox), _mm256_mul_ps(my, oy)),
+				_mm256_mul_ps(mz, oz)), _mm256_set1_ps(m[i][3]));
+			d[i] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, dx), _mm256_mul_ps(my, dy)),
+				_mm256_mul_ps(mz, dz));
+		}
+
+		// Quadratic coefficients and roots, as in Quadratic()
+		__m256 A = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], d[0]), _mm256_mul_ps(d[1], d[1])),
+			_mm256_mul_ps(d[2], d[2]));
+		__m256 B = _mm256_mul_ps(_mm256_set1_ps(2.f), _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], o[0]),
+			_mm256_mul_ps(d[1], o[1])), _mm256_mul_ps(d[2], o[2])));
+		__m256 C = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(o[0], o[0]), _mm256_mul_ps(o[1], o[1])),
+			_mm256_mul_ps(o[2], o[2])), _mm256_set1_ps(radius * radius));
+
+		__m256 zero = _mm256_setzero_ps();
+		__m256 discrim = _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.f), A), C));
+		__m256 mask = _mm256_cmp_ps(discrim, zero, _CMP_GE_OQ);
+		__m256 rootDiscrim = _mm256_sqrt_ps(_mm256_max_ps(discrim, zero));
+		__m256 minusHalf = _mm256_set1_ps(-.5f);
+		__m256 q = _mm256_blendv_ps(_mm256_mul_ps(minusHalf, _mm256_add_ps(B, rootDiscrim)),
+			_mm256_mul_ps(minusHalf, _mm256_sub_ps(B, rootDiscrim)), _mm256_cmp_ps(B, zero, _CMP_LT_OQ));
+		__m256 q0 = _mm256_div_ps(q, A);
+		__m256 q1 = _mm256_div_ps(C, q);
+		__m256 t0 = _mm256_min_ps(q0, q1);
+		__m256 t1 = _mm256_max_ps(q0, q1);
+
+		__m256 rayTMin = _mm256_load_ps(rays.tMin + start);
+		__m256 rayTMax = _mm256_load_ps(rays.tMax + start);
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t0, rayTMax, _CMP_LE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t1, rayTMin, _CMP_GE_OQ));
+		__m256 t = _mm256_blendv_ps(t0, t1, _mm256_cmp_ps(t0, rayTMin, _CMP_LT_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, rayTMax, _CMP_LE_OQ));
+
+		_mm256_storeu_ps(tHit + start, _mm256_blendv_ps(_mm256_set1_ps(INFINITY), t, mask));
+		int bits = _mm256_movemask_ps(mask);
+		for (int i = 0; i < 8; ++i)
+			hit[start + i] = (bits >> i) & 1;
+	}
+
+	void Sphere::IntersectBatch(const RayBatch &rays, float *tHit, uint8_t *hit) const {
+		const Matrix3x4 &w2o = WorldToObject->GetMatrix();
+		int start = 0;
+		if (HasAVX2()) {
+			for (; start + 8 <= rays.Size(); start += 8)
+				IntersectSphere8(w2o, mRadius, rays, start, tHit, hit);
+		}
+
+		for (int i = start; i < rays.Size(); ++i) {
+			Ray r;
+			(*WorldToObject)(rays.GetRay(i), &r);
+			hit[i] = SphereHitDistance(r, mRadius, &tHit[i]);
+			if (!hit[i]) tHit[i] = INFINITY;
+		}
+	}
+}
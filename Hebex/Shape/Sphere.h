@@ -2,19 +2,29 @@
 #define SPHERE_H
 
 #include "../Core/Shape.h"
+#include "../Core/Transform.h"
 
 namespace Hebex
 {
 	class Sphere : public Shape {
 	public:
-		Sphere(const Transform *o2w, const Transform *w2o, float rad);
+		Sphere(const AffineTransform *o2w, const AffineTransform *w2o, float rad);
 
 		BBox ObjectBound() const;
 
-		bool Intersect(const Ray &ray, Intersection *isect) const;
+		ShapeType GetType() const { return ShapeType::Sphere; }
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
 
 		bool IntersectP(const Ray &ray) const;
 
+		// Hit distances for every ray of the batch, 8 rays at a time with AVX2
+		// when available. hit[i] is 1 for rays that hit, tHit[i] is INFINITY
+		// for the others.
+		void IntersectBatch(const RayBatch &rays, float *tHit, uint8_t *hit) const;
+
 		float Area() const;
 
 		Point3f Sample(const Point2f &u, Vec3f *normal) const;
@@ -25,6 +35,7 @@ namespace Hebex
 
 	private:
 		float mRadius;
+		NormalMatrix mNormalToWorld;
 		
 		const float mThetaMax = PI;
 		const float mThetaMin = 0.f;
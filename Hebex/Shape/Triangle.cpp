@@ -0,0 +1,325 @@
+#include "Triangle.h"
+#include "../Core/Transform.h"
+#include "../Core/Intersection.h"
+#include "../Core/Sampling.h"
+#include "../Core/MemoryPool.h"
+
+namespace Hebex
+{
+	// Floats per array, rounded up so every array starts on a cache line
+	static size_t AlignedStride(int count) {
+		const int floatsPerLine = L1_CACHE_LINE_SIZE / sizeof(float);
+		return (size_t(count) + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+	}
+
+	TriangleMesh::TriangleMesh(const AffineTransform *o2w, const AffineTransform *w2o, int nTriangles, const int *vertexIndices,
+		int nVertices, const Point3f *P, const Vec3f *N, const Point2f *UV) :
+		Shape(o2w, w2o), mTriangleCount(nTriangles), mVertexCount(nVertices) {
+		Allocate(N != nullptr, UV != nullptr, true);
+		memcpy(mIndices, vertexIndices, 3 * nTriangles * sizeof(int));
+
+		for (int i = 0; i < nVertices; ++i) {
+			mPx[i] = P[i].x;
+			mPy[i] = P[i].y;
+			mPz[i] = P[i].z;
+		}
+		TransformPoints(*ObjectToWorld, mPx, mPy, mPz, mPx, mPy, mPz, nVertices);
+
+		if (N) {
+			for (int i = 0; i < nVertices; ++i) {
+				mNx[i] = N[i].x;
+				mNy[i] = N[i].y;
+				mNz[i] = N[i].z;
+			}
+			TransformNormals(NormalMatrix(*ObjectToWorld), mNx, mNy, mNz, mNx, mNy, mNz, nVertices);
+		}
+
+		if (UV) {
+			for (int i = 0; i < nVertices; ++i) {
+				mU[i] = UV[i].x;
+				mV[i] = UV[i].y;
+			}
+		}
+	}
+
+	TriangleMesh::TriangleMesh(const AffineTransform *o2w, const AffineTransform *w2o, int nTriangles, int nVertices,
+		bool hasNormals, bool hasUV) :
+		Shape(o2w, w2o), mTriangleCount(nTriangles), mVertexCount(nVertices) {
+		Allocate(hasNormals, hasUV, false);
+	}
+
+	void TriangleMesh::Allocate(bool hasNormals, bool hasUV, bool firstTouch) {
+		mIndices = AllocAligned<int>(3 * size_t(mTriangleCount));
+
+		size_t stride = AlignedStride(mVertexCount);
+		int nArrays = 3 + (hasNormals ? 3 : 0) + (hasUV ? 2 : 0);
+		mVertexData = AllocAligned<float>(nArrays * stride);
+		if (firstTouch) {
+			FirstTouch(mIndices, 3 * size_t(mTriangleCount) * sizeof(int));
+			FirstTouch(mVertexData, nArrays * stride * sizeof(float));
+		}
+		float *array = mVertexData;
+		mPx = array; array += stride;
+		mPy = array; array += stride;
+		mPz = array; array += stride;
+		if (hasNormals) {
+			mNx = array; array += stride;
+			mNy = array; array += stride;
+			mNz = array; array += stride;
+		}
+		if (hasUV) {
+			mU = array; array += stride;
+			mV = array; array += stride;
+		}
+	}
+
+	TriangleMesh::~TriangleMesh() {
+		FreeAligned(mIndices);
+		FreeAligned(mVertexData);
+	}
+
+	BBox TriangleMesh::ObjectBound() const {
+		return (*WorldToObject)(WorldBound());
+	}
+
+	BBox TriangleMesh::WorldBound() const {
+		BBox bounds;
+		for (int i = 0; i < mVertexCount; ++i)
+			bounds = Union(bounds, GetPosition(i));
+		return bounds;
+	}
+
+	void TriangleMesh::Refine(std::vector<std::shared_ptr<Shape> > &refined) const {
+		std::shared_ptr<const TriangleMesh> mesh = shared_from_this();
+		refined.reserve(refined.size() + mTriangleCount);
+		for (int i = 0; i < mTriangleCount; ++i)
+			refined.push_back(std::make_shared<Triangle>(mesh, i));
+	}
+
+	bool TriangleMesh::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		// Shrink a copy of the interval, so each hit must be closer than the last
+		Ray r = ray;
+		bool found = false;
+		for (int i = 0; i < mTriangleCount; ++i)
+			if (IntersectTriangle(i, r, hit)) {
+				r.tMax = hit->t;
+				found = true;
+			}
+		return found;
+	}
+
+	void TriangleMesh::ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		ComputeTriangleInteraction(hit.elementId, ray, hit, isect);
+	}
+
+	bool TriangleMesh::IntersectP(const Ray &ray) const {
+		for (int i = 0; i < mTriangleCount; ++i)
+			if (IntersectTriangleP(i, ray)) return true;
+		return false;
+	}
+
+	float TriangleMesh::Area() const {
+		float area = 0.f;
+		for (int i = 0; i < mTriangleCount; ++i) {
+			const int *v = &mIndices[3 * i];
+			Point3f p0 = GetPosition(v[0]), p1 = GetPosition(v[1]), p2 = GetPosition(v[2]);
+			area += .5f * Cross(p1 - p0, p2 - p0).Length();
+		}
+		return area;
+	}
+
+	BBox TriangleMesh::TriangleBound(int tri) const {
+		const int *v = &mIndices[3 * tri];
+		return Union(BBox(GetPosition(v[0]), GetPosition(v[1])), GetPosition(v[2]));
+	}
+
+	void TriangleMesh::GetUVs(int tri, Point2f uv[3]) const {
+		const int *v = &mIndices[3 * tri];
+		if (HasUV()) {
+			uv[0] = GetUV(v[0]);
+			uv[1] = GetUV(v[1]);
+			uv[2] = GetUV(v[2]);
+		}
+		else {
+			uv[0] = Point2f(0, 0);
+			uv[1] = Point2f(1, 0);
+			uv[2] = Point2f(1, 1);
+		}
+	}
+
+	bool TriangleMesh::IntersectWatertight(int tri, const Ray &ray, float *tHit, float b[3]) const {
+		const Point3f &o = ray.mOrigin;
+		const int *v = &mIndices[3 * tri];
+
+		// Translate the vertices to the ray origin and permute the axes so the
+		// largest direction component becomes z
+		Vec3f p0t = GetPosition(v[0]) - o;
+		Vec3f p1t = GetPosition(v[1]) - o;
+		Vec3f p2t = GetPosition(v[2]) - o;
+		int kz = MaxDimension(Abs(ray.mDirection));
+		int kx = kz + 1;
+		if (kx == 3) kx = 0;
+		int ky = kx + 1;
+		if (ky == 3) ky = 0;
+		Vec3f d = Permute(ray.mDirection, kx, ky, kz);
+		p0t = Permute(p0t, kx, ky, kz);
+		p1t = Permute(p1t, kx, ky, kz);
+		p2t = Permute(p2t, kx, ky, kz);
+
+		// Shear the direction onto +z; z is sheared only once a hit is likely
+		float Sx = -d.x / d.z;
+		float Sy = -d.y / d.z;
+		float Sz = 1.f / d.z;
+		p0t.x += Sx * p0t.z;
+		p0t.y += Sy * p0t.z;
+		p1t.x += Sx * p1t.z;
+		p1t.y += Sy * p1t.z;
+		p2t.x += Sx * p2t.z;
+		p2t.y += Sy * p2t.z;
+
+		// Edge functions, redone in double when one lands exactly on zero so
+		// that rays through an edge are decided consistently
+		float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+		float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+		float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+		if (e0 == 0.f || e1 == 0.f || e2 == 0.f) {
+			e0 = (float)((double)p1t.x * (double)p2t.y - (double)p1t.y * (double)p2t.x);
+			e1 = (float)((double)p2t.x * (double)p0t.y - (double)p2t.y * (double)p0t.x);
+			e2 = (float)((double)p0t.x * (double)p1t.y - (double)p0t.y * (double)p1t.x);
+		}
+
+		if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+			return false;
+		float det = e0 + e1 + e2;
+		if (det == 0.f) return false;
+
+		// Compare the scaled distance against the ray interval before dividing
+		p0t.z *= Sz;
+		p1t.z *= Sz;
+		p2t.z *= Sz;
+		float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+		if (det < 0 && (tScaled >= ray.tMin * det || tScaled < ray.tMax * det))
+			return false;
+		if (det > 0 && (tScaled <= ray.tMin * det || tScaled > ray.tMax * det))
+			return false;
+
+		float invDet = 1.f / det;
+		b[0] = e0 * invDet;
+		b[1] = e1 * invDet;
+		b[2] = e2 * invDet;
+		*tHit = tScaled * invDet;
+		return true;
+	}
+
+	bool TriangleMesh::IntersectTriangle(int tri, const Ray &ray, SurfaceHit *hit) const {
+		float b[3];
+		if (!IntersectWatertight(tri, ray, &hit->t, b)) return false;
+		hit->u = b[1];
+		hit->v = b[2];
+		hit->elementId = tri;
+		return true;
+	}
+
+	void TriangleMesh::ComputeTriangleInteraction(int tri, const Ray &ray, const SurfaceHit &hit,
+		Intersection *isect) const {
+		const int *v = &mIndices[3 * tri];
+		Point3f p0 = GetPosition(v[0]);
+		Point3f p1 = GetPosition(v[1]);
+		Point3f p2 = GetPosition(v[2]);
+		float b[3] = { 1.f - hit.u - hit.v, hit.u, hit.v };
+
+		Point2f uv[3];
+		GetUVs(tri, uv);
+
+		//dpdu, dpdv
+		float du02 = uv[0].x - uv[2].x, dv02 = uv[0].y - uv[2].y;
+		float du12 = uv[1].x - uv[2].x, dv12 = uv[1].y - uv[2].y;
+		Vec3f dp02 = p0 - p2, dp12 = p1 - p2;
+		float determinant = du02 * dv12 - dv02 * du12;
+		bool degenerateUV = std::abs(determinant) < 1e-8f;
+		float invDet = degenerateUV ? 0.f : 1.f / determinant;
+		Vec3f dpdu, dpdv;
+		if (!degenerateUV) {
+			dpdu = (dv12 * dp02 - dv02 * dp12) * invDet;
+			dpdv = (-du12 * dp02 + du02 * dp12) * invDet;
+		}
+		if (degenerateUV || Cross(dpdu, dpdv).LengthSquared() == 0.f)
+			CoordinateSystem(Normalize(Cross(p2 - p0, p1 - p0)), &dpdu, &dpdv);
+
+		Point3f pHit = b[0] * p0 + b[1] * p1 + b[2] * p2;
+		Point2f uvHit = b[0] * uv[0] + b[1] * uv[1] + b[2] * uv[2];
+
+		// Geometric normal, oriented by the interpolated normal when there is one
+		Vec3f normal = Normalize(Cross(dp02, dp12));
+		if (ObjectToWorld->SwapsHandedness()) normal = -normal;
+		Vec3f dndu, dndv;
+		if (HasNormals()) {
+			Vec3f n0 = GetNormal(v[0]), n1 = GetNormal(v[1]), n2 = GetNormal(v[2]);
+			Vec3f ns = b[0] * n0 + b[1] * n1 + b[2] * n2;
+			if (ns.LengthSquared() > 0.f) normal = Faceforward(normal, ns);
+
+			//dndu, dndv
+			if (!degenerateUV) {
+				Vec3f dn02 = n0 - n2, dn12 = n1 - n2;
+				dndu = (dv12 * dn02 - dv02 * dn12) * invDet;
+				dndv = (-du12 * dn02 + du02 * dn12) * invDet;
+			}
+		}
+
+		*isect = Intersection(pHit, normal, Vec2f(uvHit.x, uvHit.y), dpdu, dpdv, dndu, dndv);
+	}
+
+	bool TriangleMesh::IntersectTriangleP(int tri, const Ray &ray) const {
+		float tHit, b[3];
+		return IntersectWatertight(tri, ray, &tHit, b);
+	}
+
+	Triangle::Triangle(const std::shared_ptr<const TriangleMesh> &mesh, int triNumber) :
+		Shape(mesh->ObjectToWorld, mesh->WorldToObject), mMesh(mesh), mIndex(triNumber),
+		v(&mesh->GetIndices()[3 * triNumber]) {
+	}
+
+	BBox Triangle::ObjectBound() const {
+		return (*WorldToObject)(WorldBound());
+	}
+
+	BBox Triangle::WorldBound() const {
+		return mMesh->TriangleBound(mIndex);
+	}
+
+	bool Triangle::IntersectHit(const Ray &ray, SurfaceHit *hit) const {
+		return mMesh->IntersectTriangle(mIndex, ray, hit);
+	}
+
+	void Triangle::ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const {
+		mMesh->ComputeTriangleInteraction(mIndex, ray, hit, isect);
+	}
+
+	bool Triangle::IntersectP(const Ray &ray) const {
+		return mMesh->IntersectTriangleP(mIndex, ray);
+	}
+
+	float Triangle::Area() const {
+		Point3f p0 = mMesh->GetPosition(v[0]);
+		Point3f p1 = mMesh->GetPosition(v[1]);
+		Point3f p2 = mMesh->GetPosition(v[2]);
+		return .5f * Cross(p1 - p0, p2 - p0).Length();
+	}
+
+	Point3f Triangle::Sample(const Point2f &u, Vec3f *normal) const {
+		Point2f b = UniformSampleTriangle(u);
+		Point3f p0 = mMesh->GetPosition(v[0]);
+		Point3f p1 = mMesh->GetPosition(v[1]);
+		Point3f p2 = mMesh->GetPosition(v[2]);
+		Vec3f n = Normalize(Cross(p1 - p0, p2 - p0));
+		if (mMesh->HasNormals()) {
+			Vec3f ns = b[0] * mMesh->GetNormal(v[0]) + b[1] * mMesh->GetNormal(v[1]) +
+				(1 - b[0] - b[1]) * mMesh->GetNormal(v[2]);
+			n = Faceforward(n, ns);
+		}
+		else if (ObjectToWorld->SwapsHandedness())
+			n = -n;
+		*normal = n;
+		return b[0] * p0 + b[1] * p1 + (1 - b[0] - b[1]) * p2;
+	}
+}
@@ -0,0 +1,136 @@
+#ifndef TRIANGLE_H
+#define TRIANGLE_H
+
+#include "../Core/Shape.h"
+
+namespace Hebex
+{
+	// Vertex data shared by every triangle of a mesh. Positions and normals are
+	// transformed to world space once here; each attribute is stored as its
+	// own array starting on a cache line. Aggregates given a GeometricPrimitive
+	// of a mesh keep a (mesh, triangle index) leaf entry per triangle and
+	// intersect it through the per-triangle functions below, so a triangle
+	// costs its three vertex indices plus that entry. Meshes must be owned by
+	// a shared_ptr, since the triangles produced by Refine keep a reference
+	// to it.
+	class TriangleMesh : public Shape, public std::enable_shared_from_this<TriangleMesh> {
+	public:
+		// N and UV are optional. Without UV the triangle vertices get the
+		// parametrization (0, 0), (1, 0), (1, 1).
+		TriangleMesh(const AffineTransform *o2w, const AffineTransform *w2o, int nTriangles, const int *vertexIndices,
+			int nVertices, const Point3f *P, const Vec3f *N = nullptr, const Point2f *UV = nullptr);
+
+		// Allocates the buffers without filling them, for loaders that write
+		// world-space data straight into the arrays returned below
+		TriangleMesh(const AffineTransform *o2w, const AffineTransform *w2o, int nTriangles, int nVertices,
+			bool hasNormals, bool hasUV);
+
+		~TriangleMesh();
+
+		BBox ObjectBound() const;
+
+		BBox WorldBound() const;
+
+		ShapeType GetType() const { return ShapeType::TriangleMesh; }
+
+		// Triangle shapes for the generic path, e.g. area lights; aggregates
+		// do not need them
+		void Refine(std::vector<std::shared_ptr<Shape> > &refined) const;
+
+		// The whole mesh, for one used outside an aggregate (under an
+		// instance, as the root primitive, or by Pdf of an area light). Every
+		// triangle is tested; the closest one is kept in hit->elementId.
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		float Area() const;
+
+		BBox TriangleBound(int tri) const;
+
+		// Watertight test: the triangle is projected into a ray-aligned space
+		// where the ray runs along +z from the origin, so rays through a shared
+		// edge or vertex never slip between adjacent triangles. Records the
+		// barycentrics b1, b2 of the hit and tri as its elementId.
+		bool IntersectTriangle(int tri, const Ray &ray, SurfaceHit *hit) const;
+
+		bool IntersectTriangleP(int tri, const Ray &ray) const;
+
+		void ComputeTriangleInteraction(int tri, const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		int GetTriangleCount() const { return mTriangleCount; }
+
+		int GetVertexCount() const { return mVertexCount; }
+
+		const int *GetIndices() const { return mIndices; }
+
+		Point3f GetPosition(int i) const { return Point3f(mPx[i], mPy[i], mPz[i]); }
+
+		bool HasNormals() const { return mNx != nullptr; }
+
+		Vec3f GetNormal(int i) const { return Vec3f(mNx[i], mNy[i], mNz[i]); }
+
+		bool HasUV() const { return mU != nullptr; }
+
+		Point2f GetUV(int i) const { return Point2f(mU[i], mV[i]); }
+
+		// Raw arrays, one per component (axis 0-2, or 0-1 for u and v)
+		int *GetIndexArray() { return mIndices; }
+
+		float *GetPositionArray(int axis) { return (&mPx)[axis]; }
+
+		float *GetNormalArray(int axis) { return (&mNx)[axis]; }
+
+		float *GetUVArray(int i) { return (&mU)[i]; }
+
+	private:
+		TriangleMesh(const TriangleMesh &) = delete;
+		TriangleMesh &operator=(const TriangleMesh &) = delete;
+
+		// The loaders fill the arrays from the pool threads, which already
+		// spreads their pages; serial fills ask for firstTouch
+		void Allocate(bool hasNormals, bool hasUV, bool firstTouch);
+
+		// Ray-space test shared by IntersectTriangle and IntersectTriangleP,
+		// returns the hit distance and barycentrics
+		bool IntersectWatertight(int tri, const Ray &ray, float *tHit, float b[3]) const;
+
+		void GetUVs(int tri, Point2f uv[3]) const;
+
+		int mTriangleCount, mVertexCount;
+		int *mIndices;
+		float *mPx, *mPy, *mPz;
+		float *mNx = nullptr, *mNy = nullptr, *mNz = nullptr;
+		float *mU = nullptr, *mV = nullptr;
+		float *mVertexData;
+	};
+
+	// One triangle of a mesh as a standalone Shape, for the generic path
+	class Triangle : public Shape {
+	public:
+		Triangle(const std::shared_ptr<const TriangleMesh> &mesh, int triNumber);
+
+		BBox ObjectBound() const;
+
+		BBox WorldBound() const;
+
+		bool IntersectHit(const Ray &ray, SurfaceHit *hit) const;
+
+		void ComputeSurfaceInteraction(const Ray &ray, const SurfaceHit &hit, Intersection *isect) const;
+
+		bool IntersectP(const Ray &ray) const;
+
+		float Area() const;
+
+		Point3f Sample(const Point2f &u, Vec3f *normal) const;
+
+	private:
+		std::shared_ptr<const TriangleMesh> mMesh;
+		int mIndex;
+		const int *v;
+	};
+}
+
+#endif
@@ -10,9 +10,196 @@
 #include "Core/MemoryPool.h"
 #include "Core/Transform.h"
 #include "Core/Intersection.h"
+#include "Core/Sampling.h"
+#include "Core/Simd.h"
+#include "Core/CacheSimulator.h"
+#include "Accelerator/RayStream.h"
+#include <random>
+#include <cstring>
 using namespace Hebex;
 using namespace std::chrono;
+
+// Nanoseconds per SampleDiscrete with each CDF search, on random functions
+// of growing size and uniformly random u
+static void BenchmarkCDFSearch() {
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	const int nLookups = 1 << 22;
+	std::vector<float> us(nLookups);
+	for (float &u : us) u = std::min(uniform(rng), OneMinusEpsilon);
+
+	for (int n = 1 << 8; n <= 1 << 24; n <<= 4) {
+		std::vector<float> func(n);
+		for (float &f : func) f = uniform(rng) * uniform(rng);
+		std::cout << "CDF search, " << n << " bins:";
+		for (CDFSearch search : { CDFSearch::Binary, CDFSearch::Guide }) {
+			Distribution1D distrib(func.data(), n, search);
+			int64_t sum = 0;
+			auto start = high_resolution_clock::now();
+			for (float u : us) sum += distrib.SampleDiscrete(u, nullptr);
+			auto end = high_resolution_clock::now();
+			double ns = duration_cast<nanoseconds>(end - start).count() / double(nLookups);
+			std::cout << (search == CDFSearch::Binary ? " binary " : " guide ") << ns << "ns";
+			if (sum < 0) std::cout << sum;
+		}
+		std::cout << std::endl;
+	}
+}
+
+// Small rotations whose arc crosses an axis: points far from the rotation
+// axis bulge past both keyframe bounds, and MotionBounds must still hold
+// them at every time
+static void CheckMotionBounds() {
+	BBox b(Point3f(999.f, -1.f, -1.f), Point3f(1001.f, 1.f, 1.f));
+	for (float degrees : { 1.5f, .01f, .0001f }) {
+		AffineTransform start(RotateZ(-degrees)), end(RotateZ(degrees));
+		AnimatedTransform animated(&start, 0.f, &end, 1.f);
+		BBox bounds = animated.MotionBounds(b);
+		int outside = 0;
+		const int nTimes = 1000;
+		for (int i = 0; i <= nTimes; ++i) {
+			float time = (float)i / (float)nTimes;
+			if (!bounds.Inside(animated(time, Point3f(1001.f, 0.f, 0.f)))) ++outside;
+			for (int c = 0; c < 8; ++c) {
+				Point3f p((c & 1) ? b.pMax.x : b.pMin.x, (c & 2) ? b.pMax.y : b.pMin.y, (c & 4) ? b.pMax.z : b.pMin.z);
+				if (!bounds.Inside(animated(time, p))) ++outside;
+			}
+		}
+		std::cout << "MotionBounds, RotateZ(+-" << degrees << "): " << outside << " points outside" << std::endl;
+	}
+}
+
+// Runs every MatrixBackend the CPU supports on the same random matrices.
+// Mul must match Scalar bit for bit; Inverse takes different paths for
+// affine and general matrices and must agree with Scalar up to rounding,
+// relative to the largest element of the inverse.
+static void CheckMatrixBackends() {
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+	const int nMatrices = 10000;
+	const float inverseTolerance = 1e-4f;
+	std::vector<Matrix4x4> general(nMatrices), affine(nMatrices);
+	for (int i = 0; i < nMatrices; ++i) {
+		// Diagonally dominant, so well conditioned
+		for (int r = 0; r < 4; ++r)
+			for (int c = 0; c < 4; ++c)
+				general[i].m[r][c] = uniform(rng) + (r == c ? 4.f : 0.f);
+		Vec3f axis(uniform(rng), uniform(rng), uniform(rng));
+		if (axis.LengthSquared() == 0.f) axis = Vec3f(0.f, 0.f, 1.f);
+		affine[i] = (Translate(Vec3f(uniform(rng), uniform(rng), uniform(rng)) * 100.f) *
+			Rotate(180.f * uniform(rng), Normalize(axis)) *
+			Scale(1.5f + uniform(rng), 1.5f + uniform(rng), 1.5f + uniform(rng))).GetMatrix();
+	}
+
+	auto maxRelativeError = [](const Matrix4x4 &m, const Matrix4x4 &ref) {
+		float scale = 0.f, error = 0.f;
+		for (int r = 0; r < 4; ++r)
+			for (int c = 0; c < 4; ++c) {
+				scale = std::max(scale, std::abs(ref.m[r][c]));
+				error = std::max(error, std::abs(m.m[r][c] - ref.m[r][c]));
+			}
+		return error / scale;
+	};
+
+	const MatrixBackend previous = GetMatrixBackend();
+	SetMatrixBackend(MatrixBackend::Scalar);
+	std::vector<Matrix4x4> product(nMatrices), generalInverse(nMatrices), affineInverse(nMatrices);
+	for (int i = 0; i < nMatrices; ++i) {
+		product[i] = Matrix4x4::Mul(general[i], affine[(i + 1) % nMatrices]);
+		generalInverse[i] = Inverse(general[i]);
+		affineInverse[i] = Inverse(affine[i]);
+	}
+
+	for (MatrixBackend backend : { MatrixBackend::SSE, MatrixBackend::AVX2 }) {
+		const char *name = backend == MatrixBackend::SSE ? "SSE" : "AVX2";
+		if (backend == MatrixBackend::AVX2 && !HasAVX2()) {
+			std::cout << "MatrixBackend " << name << ": not supported" << std::endl;
+			continue;
+		}
+		SetMatrixBackend(backend);
+		int mulMismatches = 0, generalFailures = 0, affineFailures = 0;
+		float generalError = 0.f, affineError = 0.f;
+		for (int i = 0; i < nMatrices; ++i) {
+			if (memcmp(Matrix4x4::Mul(general[i], affine[(i + 1) % nMatrices]).m, product[i].m, sizeof(product[i].m)) != 0)
+				++mulMismatches;
+			float e = maxRelativeError(Inverse(general[i]), generalInverse[i]);
+			generalError = std::max(generalError, e);
+			if (!(e <= inverseTolerance)) ++generalFailures;
+			e = maxRelativeError(Inverse(affine[i]), affineInverse[i]);
+			affineError = std::max(affineError, e);
+			if (!(e <= inverseTolerance)) ++affineFailures;
+		}
+		std::cout << "MatrixBackend " << name << ": Mul " << mulMismatches << " mismatches, Inverse general " <<
+			generalFailures << " failures (max error " << generalError << "), affine " <<
+			affineFailures << " failures (max error " << affineError << ")" << std::endl;
+	}
+	SetMatrixBackend(previous);
+}
+
+// Simulated L1 misses per ray of a RayStream tracing the same diffuse bounce
+// rays unsorted and sorted, over a BVH much larger than the cache. Both
+// orders must find the same hits.
+static void CompareRayStreamCacheMisses() {
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	const int nSpheres = 100000;
+	std::vector<AffineTransform> transforms;
+	transforms.reserve(2 * nSpheres);
+	std::vector<std::shared_ptr<Primitive> > prims;
+	for (int i = 0; i < nSpheres; ++i) {
+		transforms.push_back(AffineTransform(Translate(Vec3f(uniform(rng), uniform(rng), uniform(rng)) * 100.f)));
+		transforms.push_back(Inverse(transforms.back()));
+		prims.push_back(std::make_shared<GeometricPrimitive>(std::make_shared<Sphere>(
+			&transforms[2 * i], &transforms[2 * i + 1], .2f + .5f * uniform(rng))));
+	}
+	BVHAccel bvh(prims);
+
+	// Camera rays in raster order; each hit spawns a bounce in a random
+	// direction of the hemisphere around the normal
+	const int width = 400, height = 400;
+	std::vector<Ray> bounces;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x) {
+			Ray ray(Point3f(50.f, 50.f, -20.f),
+				Normalize(Vec3f((x + .5f) / width - .5f, (y + .5f) / height - .5f, 1.f)));
+			Intersection isect;
+			if (!bvh.Intersect(ray, &isect)) continue;
+			Vec3f n = Normalize(isect.mNormal), d;
+			do {
+				d = Vec3f(2.f * uniform(rng) - 1.f, 2.f * uniform(rng) - 1.f, 2.f * uniform(rng) - 1.f);
+			} while (d.LengthSquared() > 1.f || d.LengthSquared() < 1e-4f);
+			d = Normalize(d);
+			if (Dot(d, n) < 0.f) d = -d;
+			bounces.push_back(Ray(isect.mPosition + n * 1e-3f, d));
+		}
+
+	RayStream unsorted(bvh, false), sorted(bvh, true);
+	for (const Ray &ray : bounces) {
+		unsorted.Enqueue(ray);
+		sorted.Enqueue(ray);
+	}
+	CacheSimulator unsortedCache, sortedCache;
+	unsorted.SetCacheSimulator(&unsortedCache);
+	sorted.SetCacheSimulator(&sortedCache);
+	unsorted.Trace();
+	sorted.Trace();
+
+	int mismatches = 0;
+	for (int i = 0; i < unsorted.Size(); ++i)
+		if (unsorted.Hit(i) != sorted.Hit(i) ||
+			(unsorted.Hit(i) && unsorted.GetRay(i).tMax != sorted.GetRay(i).tMax))
+			++mismatches;
+	std::cout << "RayStream, " << bounces.size() << " bounce rays: L1 misses per ray unsorted " <<
+		double(unsortedCache.GetMisses()) / unsorted.GetRaysTraced() << ", sorted " <<
+		double(sortedCache.GetMisses()) / sorted.GetRaysTraced() << ", " << mismatches << " mismatches" << std::endl;
+}
+
 int main() {
+	CheckMatrixBackends();
+	CheckMotionBounds();
+	CompareRayStreamCacheMisses();
+	BenchmarkCDFSearch();
+
 	/*
 	const int width = 1920;
 	const int heigh = 1080;
@@ -65,12 +252,13 @@ int main() {
 	*/
 	
 	Ray ray(Point3f(-5, 0, 0), Normalize(Vec3f(3, 2, 0)));
-	Transform o2w = Translate(Vec3f(3, 2, 0));
-	Transform w2o = Inverse(o2w);
+	AffineTransform o2w(Translate(Vec3f(3, 2, 0)));
+	AffineTransform w2o = Inverse(o2w);
 	std::cout << o2w << w2o << std::endl;
 	Sphere sphere(&o2w, &w2o, 5.0);
 	Intersection isect;
-	sphere.Intersect(ray, &isect);
+	float tHit;
+	sphere.Intersect(ray, &tHit, &isect);
 
 	std::cout << isect.mPosition << std::endl;
 